@@ -1,117 +1,620 @@
 // parseCSV.c
 #include "dataParser.h"
+#include "decompressStream.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-DataPoint* parseCSV(const char* filename, int* num_datapoints) {
-    FILE* fp = fopen(filename, "r");
-    if (!fp) {
-        perror("Error opening file in parseCSV");
-        return NULL;
-    }
+// Bytes read from the file at a time
+#define READ_BUFFER_SIZE (64 * 1024)
 
-    *num_datapoints = 0;
-    char line[MAX_TEXT_LENGTH * 4]; // Increased buffer size to handle longer lines
-    DataPoint* data = NULL;
-    int capacity = 10000; // Initial capacity
+// Bytes per text chunk; a record that outgrows its chunk moves to a larger one of its own
+#define TEXT_CHUNK_SIZE (256 * 1024)
 
-    data = (DataPoint*)malloc(capacity * sizeof(DataPoint));
-    if (!data) {
-        perror("Memory allocation failed in parseCSV");
-        fclose(fp);
-        return NULL;
+// Least input worth a parsing thread of its own
+#define MIN_PARSE_BYTES_PER_THREAD (256 * 1024)
+
+// Where the parser is within a record's fields, following RFC 4180: a field is quoted only when it
+// starts with a quote, and inside it a doubled quote stands for one while a single one closes it.
+// Only newlines inside a quoted field continue the record, so a stray quote such as 5" stays in its row.
+typedef enum {
+    FIELD_START = 0,  // At the start of a field
+    FIELD_UNQUOTED,   // Inside a field that did not start with a quote
+    FIELD_QUOTED,     // Inside a quoted field
+    FIELD_QUOTE_SEEN  // Just past a quote inside a quoted field: it closes the field unless another follows
+} QuoteState;
+
+// Record being read: its raw bytes so far, at the end of the newest chunk
+typedef struct {
+    size_t start;     // Offset of the record in data->chunks
+    size_t length;
+    QuoteState quotes; // Where the record's bytes so far end
+    int line_number;  // Line the record started on, for messages
+} PendingRecord;
+
+// Parser position within a stream of CSV bytes
+typedef struct {
+    Dataset *data;
+    PendingRecord record;
+    int line_number;   // Lines completed so far
+    int header_done;   // The first record is the header line and is skipped
+    RecordHandler handler; // If set, rows go to it instead of being stored
+    void *handler_arg;
+    int handled;       // Rows passed to the handler
+} ParseState;
+
+// Quote state after one more byte
+static QuoteState nextQuoteState(QuoteState state, char c) {
+    if (state == FIELD_QUOTED) return c == '"' ? FIELD_QUOTE_SEEN : FIELD_QUOTED;
+    if (c == '"') return state == FIELD_UNQUOTED ? FIELD_UNQUOTED : FIELD_QUOTED;
+    return (c == ',' || c == '\n') ? FIELD_START : FIELD_UNQUOTED;
+}
+
+// Quote state after the bytes from p to end, jumping from quote to quote
+// Outside a quoted field the state only depends on the previous byte, so the bytes between quotes need no look.
+static QuoteState scanQuotes(QuoteState state, const char *p, const char *end) {
+    while (p < end) {
+        if (state == FIELD_QUOTED) {
+            const char *q = memchr(p, '"', end - p);
+            if (!q) return FIELD_QUOTED;
+            state = FIELD_QUOTE_SEEN;
+            p = q + 1;
+            continue;
+        }
+        if (state != FIELD_UNQUOTED) {
+            state = nextQuoteState(state, *p++);
+            continue;
+        }
+        const char *q = memchr(p, '"', end - p);
+        if (!q) return nextQuoteState(FIELD_UNQUOTED, end[-1]);
+        state = (q > p && (q[-1] == ',' || q[-1] == '\n')) ? FIELD_QUOTED : FIELD_UNQUOTED;
+        p = q + 1;
     }
+    return state;
+}
 
-    // Read and skip header line
-    if (!fgets(line, sizeof(line), fp)) {
-        fprintf(stderr, "CSV file is empty or unreadable.\n");
-        free(data);
-        fclose(fp);
+static TextChunk* addTextChunk(Dataset *data, size_t size) {
+    TextChunk *chunk = (TextChunk*)malloc(sizeof(TextChunk) + size);
+    if (!chunk) {
+        perror("Memory allocation failed for text chunk in parseCSV");
         return NULL;
     }
+    chunk->next = data->chunks;
+    chunk->used = 0;
+    chunk->size = size;
+    data->chunks = chunk;
+    return chunk;
+}
+
+// Append raw bytes to the pending record, keeping one spare byte for its terminator
+static int appendRecordBytes(Dataset *data, PendingRecord *record, const char *bytes, size_t n) {
+    TextChunk *chunk = data->chunks;
+    if (chunk->size - record->start - record->length < n + 1) {
+        // Only this record moves; everything before it stays where it is
+        size_t needed = record->length + n + 1;
+        TextChunk *grown = addTextChunk(data, needed > TEXT_CHUNK_SIZE / 2 ? needed * 2 : TEXT_CHUNK_SIZE);
+        if (!grown) return 0;
+        memcpy(grown->data, chunk->data + record->start, record->length);
+        chunk->used = record->start;
+        record->start = 0;
+        chunk = grown;
+    }
+    memcpy(chunk->data + record->start + record->length, bytes, n);
+    record->length += n;
+    return 1;
+}
 
-    int line_number = 1; // Start counting from the first data line
+static int addRecord(Dataset *data, const char *text, size_t length, int label) {
+    if (data->num_records == data->num_blocks * RECORDS_PER_BLOCK) {
+        if (data->num_blocks == data->blocks_capacity) {
+            int capacity = data->blocks_capacity ? data->blocks_capacity * 2 : 16;
+            DataRecord **blocks = (DataRecord**)realloc(data->blocks, capacity * sizeof(DataRecord*));
+            if (!blocks) {
+                perror("Reallocation failed in parseCSV");
+                return 0;
+            }
+            data->blocks = blocks;
+            data->blocks_capacity = capacity;
+        }
+        data->blocks[data->num_blocks] = (DataRecord*)malloc(RECORDS_PER_BLOCK * sizeof(DataRecord));
+        if (!data->blocks[data->num_blocks]) {
+            perror("Memory allocation failed in parseCSV");
+            return 0;
+        }
+        data->num_blocks++;
+    }
 
-    while (fgets(line, sizeof(line), fp)) {
-        line_number++;
+    DataRecord *record = &data->blocks[data->num_records / RECORDS_PER_BLOCK][data->num_records % RECORDS_PER_BLOCK];
+    record->text = text;
+    record->length = (uint32_t)length;
+    record->label = (uint8_t)label;
+    data->num_records++;
+    return 1;
+}
 
-        // Remove potential newline character
-        line[strcspn(line, "\n")] = '\0';
+// Turn the pending record's raw bytes into text and label in place, or drop it if it is invalid
+// Returns 0 only when memory runs out or the handler fails
+static int finishRecord(ParseState *state) {
+    Dataset *data = state->data;
+    PendingRecord *record = &state->record;
+    TextChunk *chunk = data->chunks;
+    char *line = chunk->data + record->start;
+    size_t length = record->length;
+    int line_number = record->line_number;
+    record->length = 0;
+    record->quotes = FIELD_START;
 
-        // Find the position of the last comma
-        char* last_comma = strrchr(line, ',');
-        if (!last_comma) {
-            fprintf(stderr, "Invalid data format on line %d: Missing comma. Skipping.\n", line_number);
-            continue; // Skip this data point
+    // Find the position of the last comma
+    char *last_comma = NULL;
+    for (size_t i = length; i > 0; i--) {
+        if (line[i - 1] == ',') {
+            last_comma = line + i - 1;
+            break;
         }
+    }
+    if (!last_comma) {
+        fprintf(stderr, "Invalid data format on line %d: Missing comma. Skipping.\n", line_number);
+        chunk->used = record->start;
+        return 1;
+    }
 
-        // Extract label
-        char* label_str = last_comma + 1;
-        // Trim whitespace from label_str
-        while (isspace((unsigned char)*label_str)) label_str++;
-        if (*label_str == '\0') {
-            fprintf(stderr, "Invalid data format on line %d: Missing label. Skipping.\n", line_number);
-            continue; // Skip this data point
-        }
+    // Extract label; the record's spare byte terminates it for atoi
+    line[length] = '\0';
+    char* label_str = last_comma + 1;
+    // Trim whitespace from label_str
+    while (isspace((unsigned char)*label_str)) label_str++;
+    if (*label_str == '\0') {
+        fprintf(stderr, "Invalid data format on line %d: Missing label. Skipping.\n", line_number);
+        chunk->used = record->start;
+        return 1;
+    }
+
+    int label = atoi(label_str);
+    if (label < 0 || label >= NUM_LABELS) {
+        fprintf(stderr, "Invalid label %d on line %d. Skipping.\n", label, line_number);
+        chunk->used = record->start;
+        return 1;
+    }
 
-        int label = atoi(label_str);
-        if (label < 0 || label >= 6) {
-            fprintf(stderr, "Invalid label %d on line %d. Skipping.\n", label, line_number);
-            continue; // Skip this data point
+    // Extract text, removing surrounding quotes and unescaping doubled ones
+    size_t text_length = last_comma - line;
+    if (text_length >= 2 && line[0] == '"' && line[text_length - 1] == '"') {
+        size_t out = 0;
+        for (size_t i = 1; i < text_length - 1; i++) {
+            line[out++] = line[i];
+            if (line[i] == '"' && i + 1 < text_length - 1 && line[i + 1] == '"') i++;
         }
+        text_length = out;
+    }
+    if (text_length > UINT32_MAX) {
+        fprintf(stderr, "Text too long on line %d. Skipping.\n", line_number);
+        chunk->used = record->start;
+        return 1;
+    }
+    line[text_length] = '\0';
+
+    // Hand the row over and reuse its bytes for the next one
+    if (state->handler) {
+        chunk->used = record->start;
+        state->handled++;
+        return state->handler(line, (uint32_t)text_length, (uint8_t)label, state->handler_arg);
+    }
 
-        // Extract text
-        size_t text_length = last_comma - line;
-        if (text_length >= MAX_TEXT_LENGTH) {
-            fprintf(stderr, "Text too long on line %d. Skipping.\n", line_number);
-            continue; // Skip this data point
+    // Keep the text (and its terminator) in the arena
+    chunk->used = record->start + text_length + 1;
+    data->text_bytes += text_length + 1;
+    return addRecord(data, line, text_length, label);
+}
+
+static int initParseState(ParseState *state, int line_number, int header_done) {
+    state->data = (Dataset*)calloc(1, sizeof(Dataset));
+    if (!state->data || !addTextChunk(state->data, TEXT_CHUNK_SIZE)) {
+        perror("Memory allocation failed in parseCSV");
+        freeDataset(state->data);
+        state->data = NULL;
+        return 0;
+    }
+    state->record = (PendingRecord){ .start = 0, .length = 0, .quotes = FIELD_START, .line_number = 0 };
+    state->line_number = line_number;
+    state->header_done = header_done;
+    state->handler = NULL;
+    state->handler_arg = NULL;
+    state->handled = 0;
+    return 1;
+}
+
+// Feed the next n bytes of the file to the parser; rows may span calls
+static int parseBytes(ParseState *state, const char *bytes, size_t n) {
+    Dataset *data = state->data;
+    PendingRecord *record = &state->record;
+    size_t pos = 0;
+    int ok = 1;
+    while (ok && pos < n) {
+        if (record->length == 0) {
+            record->start = data->chunks->used;
+            record->line_number = state->line_number + 1;
         }
 
-        char text_buffer[MAX_TEXT_LENGTH];
-        strncpy(text_buffer, line, text_length);
-        text_buffer[text_length] = '\0'; // Null-terminate
+        // Take everything up to the next newline in one piece, tracking the quote state on the way
+        const char *newline = memchr(bytes + pos, '\n', n - pos);
+        size_t end = newline ? (size_t)(newline - bytes) : n;
+        record->quotes = scanQuotes(record->quotes, bytes + pos, bytes + end);
+        ok = appendRecordBytes(data, record, bytes + pos, end - pos);
+        pos = end;
+        if (!ok || !newline) break;
 
-        // Remove surrounding quotes if present
-        if (text_buffer[0] == '"' && text_buffer[text_length - 1] == '"') {
-            text_buffer[text_length - 1] = '\0';
-            memmove(text_buffer, text_buffer + 1, text_length - 1);
+        pos++; // Consume the newline
+        state->line_number++;
+        if (record->quotes == FIELD_QUOTED) {
+            ok = appendRecordBytes(data, record, "\n", 1);
+        }
+        else if (!state->header_done) {
+            state->header_done = 1;
+            record->length = 0;
+            record->quotes = FIELD_START;
+            data->chunks->used = record->start;
+        }
+        else {
+            ok = finishRecord(state);
         }
+    }
+    return ok;
+}
 
-        // Store the data point
-        strncpy(data[*num_datapoints].text, text_buffer, MAX_TEXT_LENGTH - 1);
-        data[*num_datapoints].text[MAX_TEXT_LENGTH - 1] = '\0'; // Ensure null-termination
-        data[*num_datapoints].label = label;
+// The last line may lack a newline
+static int finishParse(ParseState *state) {
+    if (state->record.length > 0 && state->header_done) {
+        return finishRecord(state);
+    }
+    return 1;
+}
 
-        (*num_datapoints)++;
+// Parse a compressed file while a producer thread decompresses it, straight from the decompressed blocks
+static int parseCompressedFile(const char *filename, CsvCompression compression, ParseState *state) {
+    DecompressStream *stream = openDecompressStream(filename, compression);
+    if (!stream) return 0;
 
-        // If we've reached capacity, realloc to increase size
-        if (*num_datapoints >= capacity) {
-            capacity *= 2;
-            DataPoint* temp = realloc(data, capacity * sizeof(DataPoint));
-            if (!temp) {
-                perror("Reallocation failed in parseCSV");
-                free(data);
-                fclose(fp);
-                return NULL;
-            }
-            data = temp;
+    int saw_bytes = 0;
+    int ok = 1;
+    int status;
+    const char *bytes;
+    size_t n;
+    while ((status = decompressStreamNext(stream, &bytes, &n)) > 0) {
+        if (n > 0) saw_bytes = 1;
+        ok = parseBytes(state, bytes, n);
+        decompressStreamRelease(stream);
+        if (!ok) break;
+    }
+    if (!closeDecompressStream(stream) || status < 0) ok = 0;
+    if (ok && !saw_bytes) {
+        fprintf(stderr, "CSV file is empty or unreadable.\n");
+        ok = 0;
+    }
+    if (ok) {
+        ok = finishParse(state);
+    }
+    return ok;
+}
+
+// Read a file from byte offset on through the parser in blocks
+// gzip and zstd files are decompressed on the fly; they can only be read from the start
+static int parseFile(const char *filename, size_t offset, ParseState *state) {
+    CsvCompression compression = csvCompression(filename);
+    if (compression != CSV_PLAIN) {
+        if (offset > 0) {
+            fprintf(stderr, "Cannot start reading a compressed file part way through.\n");
+            return 0;
         }
+        return parseCompressedFile(filename, compression, state);
     }
 
+    FILE* fp = fopen(filename, "rb");
+    if (!fp) {
+        perror("Error opening file in parseCSV");
+        return 0;
+    }
+    if (offset > 0 && fseeko(fp, (off_t)offset, SEEK_SET) != 0) {
+        perror("Error seeking in file in parseCSV");
+        fclose(fp);
+        return 0;
+    }
+    char *buffer = (char*)malloc(READ_BUFFER_SIZE);
+    if (!buffer) {
+        perror("Memory allocation failed in parseCSV");
+        fclose(fp);
+        return 0;
+    }
+
+    int saw_bytes = 0;
+    int ok = 1;
+    size_t got;
+    while (ok && (got = fread(buffer, 1, READ_BUFFER_SIZE, fp)) > 0) {
+        saw_bytes = 1;
+        ok = parseBytes(state, buffer, got);
+    }
+    if (ok && ferror(fp)) {
+        perror("Error reading file in parseCSV");
+        ok = 0;
+    }
+    if (ok && !saw_bytes && offset == 0) {
+        fprintf(stderr, "CSV file is empty or unreadable.\n");
+        ok = 0;
+    }
+    if (ok) {
+        ok = finishParse(state);
+    }
+
+    free(buffer);
     fclose(fp);
+    return ok;
+}
+
+// Parse a CSV of "text,label" rows (after one header line) into a dataset
+// Rows are read in blocks and their text appended straight into the arena, so line length is unlimited
+// and memory grows with the data actually stored. A newline inside a quoted field does not end the row.
+Dataset* parseCSV(const char* filename) {
+    ParseState state;
+    if (!initParseState(&state, 0, 0)) return NULL;
+    if (!parseFile(filename, 0, &state)) {
+        freeDataset(state.data);
+        return NULL;
+    }
+    return state.data;
+}
+
+// Stream a CSV through a handler, one row at a time, parsed exactly as parseCSV would
+// Only the row being read is held in memory; its bytes are reused once the handler returns
+int parseCSVRecords(const char* filename, RecordHandler handler, void *arg) {
+    return parseCSVRecordsFrom(filename, 0, 0, handler, arg);
+}
+
+// Offset 0 parses the header as usual; any other offset must start a row past it
+int parseCSVRecordsFrom(const char* filename, size_t offset, int lines_before, RecordHandler handler, void *arg) {
+    ParseState state;
+    if (!initParseState(&state, lines_before, offset > 0)) return -1;
+    state.handler = handler;
+    state.handler_arg = arg;
+    int ok = parseFile(filename, offset, &state);
+    freeDataset(state.data);
+    return ok ? state.handled : -1;
+}
+
+// One thread's share of a mapped file
+typedef struct {
+    const char *map;
+    size_t begin, end;      // Byte range of whole rows
+    size_t scan_begin;      // First pass: nominal range to scan quotes and count newlines in
+    size_t scan_end;
+    QuoteState exits[4];    // First pass results: the quote state at scan_end for each state at scan_begin
+    int newlines;
+    int first_line;         // Lines before begin
+    RecordHandler handler;  // Rows go here if set, otherwise into data
+    void *handler_arg;
+    Dataset *data;          // Second pass result
+    int handled;
+    int ok;
+} ParseWorker;
+
+static void* countWorker(void *arg) {
+    ParseWorker *worker = (ParseWorker*)arg;
+    const char *p = worker->map + worker->scan_begin;
+    const char *end = worker->map + worker->scan_end;
+    int newlines = 0;
+    for (const char *q = memchr(p, '\n', end - p); q; q = memchr(q + 1, '\n', end - q - 1)) newlines++;
+    worker->newlines = newlines;
+
+    // Outside a quoted field, every state reaches the same one after a first byte that is not a quote,
+    // so two scans of the range cover all four starting states unless it starts with a quote
+    worker->exits[FIELD_QUOTED] = scanQuotes(FIELD_QUOTED, p, end);
+    worker->exits[FIELD_UNQUOTED] = scanQuotes(FIELD_UNQUOTED, p, end);
+    QuoteState exit = worker->exits[FIELD_UNQUOTED];
+    if (p == end) exit = FIELD_START;
+    else if (*p == '"') exit = scanQuotes(FIELD_QUOTED, p + 1, end);
+    worker->exits[FIELD_START] = exit;
+    worker->exits[FIELD_QUOTE_SEEN] = p == end ? FIELD_QUOTE_SEEN : exit;
+    return NULL;
+}
+
+static void* parseWorker(void *arg) {
+    ParseWorker *worker = (ParseWorker*)arg;
+    ParseState state;
+    worker->ok = 0;
+    if (!initParseState(&state, worker->first_line, worker->begin > 0)) return NULL;
+    state.handler = worker->handler;
+    state.handler_arg = worker->handler_arg;
+    if (!parseBytes(&state, worker->map + worker->begin, worker->end - worker->begin) || !finishParse(&state)) {
+        freeDataset(state.data);
+        return NULL;
+    }
+    worker->handled = state.handled;
+    if (worker->handler) {
+        freeDataset(state.data);
+    }
+    else {
+        worker->data = state.data;
+    }
+    worker->ok = 1;
+    return NULL;
+}
+
+// Map a file for parsing on up to *num_threads threads, lowering the count for small files
+// NULL means the file is better read with stdio, or is compressed and has to be read as a stream
+static const char* mapForParsing(const char *filename, int *num_threads, size_t *size) {
+    if (csvCompression(filename) != CSV_PLAIN) return NULL;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL; // parseCSV reports it
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+    *size = (size_t)st.st_size;
+    if ((size_t)*num_threads > *size / MIN_PARSE_BYTES_PER_THREAD) {
+        *num_threads = (int)(*size / MIN_PARSE_BYTES_PER_THREAD);
+    }
+    if (*num_threads <= 1) {
+        close(fd);
+        return NULL;
+    }
+    const char *map = (const char*)mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+    madvise((void*)map, *size, MADV_SEQUENTIAL);
+    return map;
+}
 
-    // Optionally, shrink the allocated memory to fit the actual number of data points
-    if (*num_datapoints < capacity) {
-        DataPoint* temp = realloc(data, (*num_datapoints) * sizeof(DataPoint));
-        if (temp) {
-            data = temp;
+// Run fn on every worker, one thread each; a worker whose thread cannot start runs on the calling thread
+static void runParseWorkers(void* (*fn)(void*), ParseWorker *workers, int num_threads) {
+    pthread_t threads[MAX_PARSE_THREADS];
+    int started[MAX_PARSE_THREADS];
+    for (int t = 0; t < num_threads; t++) {
+        started[t] = pthread_create(&threads[t], NULL, fn, &workers[t]) == 0;
+        if (!started[t]) {
+            fprintf(stderr, "Failed to start parsing thread %d, running its range inline.\n", t);
         }
-        // If realloc fails, continue with the larger memory block
     }
+    for (int t = 0; t < num_threads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        }
+        else {
+            fn(&workers[t]);
+        }
+    }
+}
+
+// Split a mapped file into row-aligned ranges and parse them on one thread each
+// A first pass scans quotes and counts newlines per range, which gives the quote state and line number
+// at every nominal split point; each split then moves forward to the next newline outside quotes,
+// so every thread starts on a row boundary.
+static int parseMappedFile(const char *map, size_t size, int num_threads, ParseWorker *workers) {
+    for (int t = 0; t < num_threads; t++) {
+        workers[t].map = map;
+        workers[t].scan_begin = size * t / num_threads;
+        workers[t].scan_end = size * (t + 1) / num_threads;
+    }
+    runParseWorkers(countWorker, workers, num_threads);
+
+    // Move each split to just past the first newline outside quotes at or after it
+    QuoteState quotes = FIELD_START;
+    int lines = 0;
+    workers[0].begin = 0;
+    workers[0].first_line = 0;
+    for (int t = 1; t < num_threads; t++) {
+        quotes = workers[t - 1].exits[quotes];
+        lines += workers[t - 1].newlines;
+        size_t split = workers[t].scan_begin;
+        QuoteState state = quotes;
+        int line = lines;
+        if (split < workers[t - 1].begin) {
+            // The previous split already ran past this one
+            split = workers[t - 1].begin;
+            state = FIELD_START;
+            line = workers[t - 1].first_line;
+        }
+        while (split < size) {
+            char c = map[split++];
+            if (c == '\n') {
+                line++;
+                if (state != FIELD_QUOTED) break;
+            }
+            state = nextQuoteState(state, c);
+        }
+        workers[t].begin = split;
+        workers[t].first_line = line;
+        workers[t - 1].end = split;
+    }
+    workers[num_threads - 1].end = size;
+
+    runParseWorkers(parseWorker, workers, num_threads);
+    int ok = 1;
+    for (int t = 0; t < num_threads; t++) {
+        if (!workers[t].ok) ok = 0;
+    }
+    return ok;
+}
+
+// Move src's records (in order) and text chunks onto the end of dst; texts stay where they are
+static int appendDataset(Dataset *dst, Dataset *src) {
+    for (int i = 0; i < src->num_records; i++) {
+        const DataRecord *record = datasetRecord(src, i);
+        if (!addRecord(dst, record->text, record->length, record->label)) return 0;
+    }
+    TextChunk **tail = &src->chunks;
+    while (*tail) tail = &(*tail)->next;
+    *tail = dst->chunks;
+    dst->chunks = src->chunks;
+    src->chunks = NULL;
+    dst->text_bytes += src->text_bytes;
+    return 1;
+}
+
+int parseCSVThreads(int num_threads) {
+    if (num_threads <= 0) num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    return num_threads > MAX_PARSE_THREADS ? MAX_PARSE_THREADS : num_threads;
+}
+
+// Parse a CSV the same way as parseCSV, but from a read-only mapping split across threads
+// Threads parse into their own arenas and the results are joined in file order.
+// Falls back to parseCSV for small files or anything that cannot be mapped.
+Dataset* parseCSVParallel(const char* filename, int num_threads) {
+    num_threads = parseCSVThreads(num_threads);
+    size_t size;
+    const char *map = mapForParsing(filename, &num_threads, &size);
+    if (!map) return parseCSV(filename);
 
+    ParseWorker workers[MAX_PARSE_THREADS] = {0};
+    int ok = parseMappedFile(map, size, num_threads, workers);
+    munmap((void*)map, size);
+
+    Dataset *data = ok ? workers[0].data : NULL;
+    for (int t = 1; t < num_threads; t++) {
+        if (ok && !appendDataset(data, workers[t].data)) ok = 0;
+        if (workers[t].ok) freeDataset(workers[t].data);
+    }
+    if (!ok) {
+        if (workers[0].ok) freeDataset(workers[0].data);
+        return NULL;
+    }
     return data;
 }
 
-void freeData(DataPoint* data, int num_datapoints) {
-    if (data) {
-        free(data);
+// Stream a CSV through one handler argument per thread; each gets the rows of one contiguous range, in order
+// Small files use fewer ranges, down to a single one read with stdio, and the remaining args get no rows
+int parseCSVRecordsParallel(const char* filename, int num_threads, RecordHandler handler, void **args) {
+    num_threads = parseCSVThreads(num_threads);
+    size_t size;
+    const char *map = mapForParsing(filename, &num_threads, &size);
+    if (!map) return parseCSVRecords(filename, handler, args[0]);
+
+    ParseWorker workers[MAX_PARSE_THREADS] = {0};
+    for (int t = 0; t < num_threads; t++) {
+        workers[t].handler = handler;
+        workers[t].handler_arg = args[t];
+    }
+    int ok = parseMappedFile(map, size, num_threads, workers);
+    munmap((void*)map, size);
+
+    int handled = 0;
+    for (int t = 0; t < num_threads; t++) {
+        handled += workers[t].handled;
+    }
+    return ok ? handled : -1;
+}
+
+void freeDataset(Dataset* data) {
+    if (!data) return;
+    TextChunk *chunk = data->chunks;
+    while (chunk) {
+        TextChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
     }
-}
\ No newline at end of file
+    for (int b = 0; b < data->num_blocks; b++) {
+        free(data->blocks[b]);
+    }
+    free(data->blocks);
+    free(data);
+}
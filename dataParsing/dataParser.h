@@ -4,17 +4,65 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <ctype.h>
 
-#define MAX_TEXT_LENGTH 1024
+// Number of emotion classes; labels outside [0, NUM_LABELS) are rejected
+#define NUM_LABELS 6
 
+// Block of text bytes; texts never move once stored
+typedef struct TextChunk {
+    struct TextChunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+} TextChunk;
+
+// One parsed row: its NUL-terminated text (quotes removed) lives in the dataset's arena
+typedef struct {
+    const char *text;
+    uint32_t length;
+    uint8_t label;
+} DataRecord;
+
+// Records are kept in fixed-size blocks so the dataset grows without ever copying them
+#define RECORDS_PER_BLOCK 4096
+
+// Parsed CSV: compact records plus a chunked arena holding every text back to back
 typedef struct {
-    char text[MAX_TEXT_LENGTH];
-    int label;
-} DataPoint;
+    int num_records;
+    DataRecord **blocks;   // RECORDS_PER_BLOCK records each
+    int num_blocks;
+    int blocks_capacity;
+    TextChunk *chunks;     // Most recent chunk first
+    size_t text_bytes;     // Bytes of text stored, terminators included
+} Dataset;
+
+static inline const DataRecord* datasetRecord(const Dataset *data, int i) {
+    return &data->blocks[i / RECORDS_PER_BLOCK][i % RECORDS_PER_BLOCK];
+}
+
+// Most threads the parallel parsers use
+#define MAX_PARSE_THREADS 64
+
+// Receives each valid row in file order; text is NUL-terminated and only valid during the call
+// Return 0 to stop parsing with an error
+typedef int (*RecordHandler)(const char *text, uint32_t length, uint8_t label, void *arg);
 
 // Function prototypes
-DataPoint* parseCSV(const char* filename, int* num_datapoints);
-void freeData(DataPoint* data, int num_datapoints);
+// Every parser also reads gzip and zstd compressed files (see decompressStream.h), sequentially
+Dataset* parseCSV(const char* filename);
+// Same result as parseCSV, parsed on num_threads threads (0 = all cores) from a memory mapping
+Dataset* parseCSVParallel(const char* filename, int num_threads);
+// Stream every valid row to handler without storing any text; returns the number of rows, or -1 on error
+int parseCSVRecords(const char* filename, RecordHandler handler, void *arg);
+// Same, for the rows from byte offset on (e.g. rows appended since the first offset bytes were parsed);
+// lines_before is the number of lines ahead of offset, so error messages keep their line numbers
+int parseCSVRecordsFrom(const char* filename, size_t offset, int lines_before, RecordHandler handler, void *arg);
+// Threads the parallel parsers use for a requested count (0 = all cores)
+int parseCSVThreads(int num_threads);
+// Stream rows on parseCSVThreads(num_threads) threads; args[t] receives range t of the file, ranges in file order
+int parseCSVRecordsParallel(const char* filename, int num_threads, RecordHandler handler, void **args);
+void freeDataset(Dataset* data);
 
-#endif
\ No newline at end of file
+#endif
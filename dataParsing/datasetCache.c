@@ -0,0 +1,526 @@
+#include "datasetCache.h"
+#include "dataParser.h"
+#include "decompressStream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Cache file version written by saveDatasetCache()
+// Version 1: key, vocabulary, CSR rows and labels
+// Version 2: version 1 plus csv_lines, so rows appended to the CSV can be parsed on their own
+#define DATASET_CACHE_VERSION 2
+
+// Sections start on cache-line boundaries
+#define CACHE_SECTION_ALIGNMENT 64
+
+// Header of a cache file, followed by the sections it points at:
+//   size_t row_offsets[num_samples + 1]
+//   uint32_t indices[nnz]
+//   float counts[nnz]
+//   uint32_t word_offsets[vocab_size]  offset of each word inside the string section
+//   uint8_t labels[num_samples]
+//   char strings[strings_size]         NUL-terminated words, in id order
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    int32_t num_samples;
+    // Key: the CSV this was built from and the options it was built with
+    uint64_t csv_size;        // Bytes of the CSV ingested; rows appended after them can be ingested on their own
+    int64_t csv_mtime_sec;
+    int64_t csv_mtime_nsec;
+    uint64_t csv_hash;        // hashFilePrefix() of those bytes
+    uint64_t csv_lines;       // Lines in those bytes
+    uint64_t min_count;
+    double max_doc_fraction;
+    int32_t max_words;
+    int32_t hash_bits;
+    int32_t sketch_words;
+    int32_t vocab_size;
+    uint64_t nnz;
+    uint64_t text_bytes;
+    uint64_t row_offsets_offset;
+    uint64_t indices_offset;
+    uint64_t counts_offset;
+    uint64_t word_offsets_offset;
+    uint64_t labels_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    VocabStats stats;
+} DatasetCacheHeader;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// xxHash64-style round: four of these run side by side over 32-byte stripes
+static inline uint64_t hashRound(uint64_t lane, uint64_t word) {
+    return rotl64(lane + word * 0xc2b2ae3d27d4eb4fULL, 31) * 0x9e3779b185ebca87ULL;
+}
+
+// Hash of size bytes; four independent lanes keep it memory bound rather than multiply bound
+static uint64_t hashBytes(const unsigned char *data, size_t size) {
+    uint64_t lanes[4] = { 1, 2, 3, 4 };
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (int l = 0; l < 4; l++) {
+            uint64_t word;
+            memcpy(&word, data + i + 8 * l, sizeof(word));
+            lanes[l] = hashRound(lanes[l], word);
+        }
+    }
+    uint64_t hash = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18) + size;
+    for (; i < size; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+int hashFilePrefix(const char *filename, uint64_t size, uint64_t *hash, uint64_t *lines) {
+    if (size == 0) {
+        *hash = hashBytes(NULL, 0);
+        if (lines) *lines = 0;
+        return 1;
+    }
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open file for hashing");
+        return 0;
+    }
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror("Failed to map file for hashing");
+        return 0;
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    *hash = hashBytes((const unsigned char*)mapping, size);
+    if (lines) {
+        *lines = 0;
+        const char *end = (const char*)mapping + size;
+        for (const char *p = memchr(mapping, '\n', size); p; p = memchr(p + 1, '\n', end - p - 1)) {
+            (*lines)++;
+        }
+    }
+    munmap(mapping, size);
+    return 1;
+}
+
+static uint64_t alignSection(uint64_t offset) {
+    return (offset + CACHE_SECTION_ALIGNMENT - 1) / CACHE_SECTION_ALIGNMENT * CACHE_SECTION_ALIGNMENT;
+}
+
+static int writeZeros(FILE *fp, uint64_t count) {
+    static const char zeros[CACHE_SECTION_ALIGNMENT] = {0};
+    return count <= sizeof(zeros) && fwrite(zeros, 1, count, fp) == count;
+}
+
+// Write one array of every part back to back at its section's offset, padding from the end of the previous section
+static int writeSection(FILE *fp, uint64_t *position, uint64_t offset, const TrainingSet *const *parts, int num_parts,
+                        size_t field, size_t element_size, int per_sample) {
+    if (!writeZeros(fp, offset - *position)) return 0;
+    *position = offset;
+    for (int p = 0; p < num_parts; p++) {
+        const void *data = *(void *const *)((const char*)parts[p] + field);
+        size_t count = per_sample ? (size_t)parts[p]->num_samples : parts[p]->nnz;
+        if (fwrite(data, element_size, count, fp) != count) return 0;
+        *position += count * element_size;
+    }
+    return 1;
+}
+
+// Row offsets of the parts as one set: each part's offsets are shifted past the entries before it
+static int writeRowOffsets(FILE *fp, uint64_t *position, uint64_t offset, const TrainingSet *const *parts, int num_parts) {
+    size_t buffer[1024];
+    size_t fill = 0;
+    size_t base = 0;
+    uint64_t written = 1;
+    if (!writeZeros(fp, offset - *position)) return 0;
+    buffer[fill++] = 0;
+    for (int p = 0; p < num_parts; p++) {
+        for (int i = 1; i <= parts[p]->num_samples; i++) {
+            buffer[fill++] = base + parts[p]->row_offsets[i];
+            written++;
+            if (fill == sizeof(buffer) / sizeof(buffer[0])) {
+                if (fwrite(buffer, sizeof(size_t), fill, fp) != fill) return 0;
+                fill = 0;
+            }
+        }
+        base += parts[p]->nnz;
+    }
+    if (fwrite(buffer, sizeof(size_t), fill, fp) != fill) return 0;
+    *position = offset + written * sizeof(size_t);
+    return 1;
+}
+
+static void fillKey(DatasetCacheHeader *header, const struct stat *csv_stat, uint64_t csv_hash, uint64_t csv_lines, const VocabOptions *options) {
+    memset(header, 0, sizeof(DatasetCacheHeader));
+    memcpy(header->magic, "EMOTCACH", 8);
+    header->version = DATASET_CACHE_VERSION;
+    header->csv_size = (uint64_t)csv_stat->st_size;
+    header->csv_mtime_sec = (int64_t)csv_stat->st_mtim.tv_sec;
+    header->csv_mtime_nsec = (int64_t)csv_stat->st_mtim.tv_nsec;
+    header->csv_hash = csv_hash;
+    header->csv_lines = csv_lines;
+    if (options) {
+        header->min_count = options->min_count;
+        header->max_doc_fraction = options->max_doc_fraction;
+        header->max_words = options->max_words;
+        header->hash_bits = options->hash_bits;
+        header->sketch_words = options->hash_bits ? 0 : options->sketch_words;
+    }
+}
+
+static int sameOptions(const DatasetCacheHeader *header, const VocabOptions *options) {
+    VocabOptions none;
+    memset(&none, 0, sizeof(none));
+    if (!options) options = &none;
+    return header->min_count == options->min_count &&
+           header->max_doc_fraction == options->max_doc_fraction &&
+           header->max_words == options->max_words &&
+           header->hash_bits == options->hash_bits &&
+           header->sketch_words == (options->hash_bits ? 0 : options->sketch_words);
+}
+
+static int sameFile(const DatasetCacheHeader *header, const struct stat *csv_stat) {
+    return header->csv_size == (uint64_t)csv_stat->st_size &&
+           header->csv_mtime_sec == (int64_t)csv_stat->st_mtim.tv_sec &&
+           header->csv_mtime_nsec == (int64_t)csv_stat->st_mtim.tv_nsec;
+}
+
+// Write the rows of parts[0], parts[1], ... as one set, under the key already in header
+// The file is written under a temporary name and renamed over cache_filename once complete, so a cache cut
+// short is never read and a process that still has the old cache mapped keeps reading the old file
+static int writeDatasetCache(const char *cache_filename, DatasetCacheHeader *header, const TrainingSet *const *parts, int num_parts,
+                             const StringTable *vocab_table) {
+    // Lay out the file: header, then the 8-, 4- and 1-byte aligned sections
+    header->num_samples = 0;
+    header->nnz = 0;
+    for (int p = 0; p < num_parts; p++) {
+        header->num_samples += parts[p]->num_samples;
+        header->nnz += parts[p]->nnz;
+    }
+    header->vocab_size = vocab_table ? vocab_table->count : 0;
+    header->row_offsets_offset = alignSection(sizeof(DatasetCacheHeader));
+    header->indices_offset = alignSection(header->row_offsets_offset + ((uint64_t)header->num_samples + 1) * sizeof(size_t));
+    header->counts_offset = alignSection(header->indices_offset + header->nnz * sizeof(uint32_t));
+    header->word_offsets_offset = alignSection(header->counts_offset + header->nnz * sizeof(float));
+    header->labels_offset = alignSection(header->word_offsets_offset + (uint64_t)header->vocab_size * sizeof(uint32_t));
+    header->strings_offset = header->labels_offset + (uint64_t)header->num_samples;
+    header->strings_size = 0;
+    for (int i = 0; i < header->vocab_size; i++) {
+        header->strings_size += vocab_table->lengths[i] + 1;
+    }
+    if (header->strings_size > UINT32_MAX) {
+        fprintf(stderr, "Vocabulary too large to cache.\n");
+        return 0;
+    }
+
+    uint32_t *word_offsets = (uint32_t*)malloc((header->vocab_size > 0 ? header->vocab_size : 1) * sizeof(uint32_t));
+    char *temp_filename = (char*)malloc(strlen(cache_filename) + 5);
+    if (!word_offsets || !temp_filename) {
+        perror("Memory allocation failed for dataset cache");
+        free(word_offsets);
+        free(temp_filename);
+        return 0;
+    }
+    uint32_t offset = 0;
+    for (int i = 0; i < header->vocab_size; i++) {
+        word_offsets[i] = offset;
+        offset += vocab_table->lengths[i] + 1;
+    }
+    sprintf(temp_filename, "%s.tmp", cache_filename);
+
+    FILE *fp = fopen(temp_filename, "wb");
+    if (!fp) {
+        perror("Failed to open dataset cache for writing");
+        free(word_offsets);
+        free(temp_filename);
+        return 0;
+    }
+    uint64_t position = sizeof(DatasetCacheHeader);
+    int ok = fwrite(header, sizeof(DatasetCacheHeader), 1, fp) == 1 &&
+             writeRowOffsets(fp, &position, header->row_offsets_offset, parts, num_parts) &&
+             writeSection(fp, &position, header->indices_offset, parts, num_parts, offsetof(TrainingSet, indices), sizeof(uint32_t), 0) &&
+             writeSection(fp, &position, header->counts_offset, parts, num_parts, offsetof(TrainingSet, counts), sizeof(float), 0) &&
+             writeZeros(fp, header->word_offsets_offset - position) &&
+             fwrite(word_offsets, sizeof(uint32_t), header->vocab_size, fp) == (size_t)header->vocab_size;
+    position = header->word_offsets_offset + (uint64_t)header->vocab_size * sizeof(uint32_t);
+    ok = ok && writeSection(fp, &position, header->labels_offset, parts, num_parts, offsetof(TrainingSet, labels), sizeof(uint8_t), 1);
+    for (int i = 0; ok && i < header->vocab_size; i++) {
+        size_t word_length = vocab_table->lengths[i] + 1;
+        if (fwrite(vocab_table->words[i], 1, word_length, fp) != word_length) ok = 0;
+    }
+    free(word_offsets);
+    if (fclose(fp) != 0) ok = 0;
+    if (ok && rename(temp_filename, cache_filename) != 0) {
+        perror("Failed to replace dataset cache");
+        ok = 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to write dataset cache '%s'.\n", cache_filename);
+        remove(temp_filename);
+    }
+    free(temp_filename);
+    return ok;
+}
+
+int saveDatasetCache(const char *cache_filename, const struct stat *csv_stat, uint64_t csv_hash, uint64_t csv_lines, const VocabOptions *options,
+                     const TrainingSet *set, const StringTable *vocab_table, size_t text_bytes, const VocabStats *stats) {
+    DatasetCacheHeader header;
+    fillKey(&header, csv_stat, csv_hash, csv_lines, options);
+    header.text_bytes = text_bytes;
+    header.stats = *stats;
+    return writeDatasetCache(cache_filename, &header, &set, 1, vocab_table);
+}
+
+// Check that every offset, id and label in a mapped cache is in range before anything indexes with it
+static int validCache(const char *base, size_t file_size, const DatasetCacheHeader *header) {
+    uint64_t samples = (uint64_t)header->num_samples;
+    uint64_t vocab_size = (uint64_t)header->vocab_size;
+    if (header->num_samples < 0 || header->vocab_size < 0 ||
+        header->hash_bits < 0 || header->hash_bits > MAX_FEATURE_HASH_BITS || (header->hash_bits && header->vocab_size)) return 0;
+    if (header->row_offsets_offset % CACHE_SECTION_ALIGNMENT || header->indices_offset % CACHE_SECTION_ALIGNMENT ||
+        header->counts_offset % CACHE_SECTION_ALIGNMENT || header->word_offsets_offset % CACHE_SECTION_ALIGNMENT) return 0;
+    if (header->row_offsets_offset > file_size || (samples + 1) * sizeof(size_t) > file_size - header->row_offsets_offset ||
+        header->indices_offset > file_size || header->nnz > (file_size - header->indices_offset) / sizeof(uint32_t) ||
+        header->counts_offset > file_size || header->nnz > (file_size - header->counts_offset) / sizeof(float) ||
+        header->word_offsets_offset > file_size || vocab_size * sizeof(uint32_t) > file_size - header->word_offsets_offset ||
+        header->labels_offset > file_size || samples > file_size - header->labels_offset ||
+        header->strings_offset > file_size || header->strings_size > file_size - header->strings_offset ||
+        (vocab_size > 0 && (header->strings_size == 0 || base[header->strings_offset + header->strings_size - 1] != '\0'))) return 0;
+
+    const size_t *row_offsets = (const size_t*)(base + header->row_offsets_offset);
+    if (row_offsets[0] != 0 || row_offsets[samples] != header->nnz) return 0;
+    for (uint64_t i = 0; i < samples; i++) {
+        if (row_offsets[i + 1] < row_offsets[i]) return 0;
+    }
+    const uint8_t *labels = (const uint8_t*)(base + header->labels_offset);
+    for (uint64_t i = 0; i < samples; i++) {
+        if (labels[i] >= NUM_LABELS) return 0;
+    }
+    uint32_t input_size = header->hash_bits ? 1u << header->hash_bits : (uint32_t)header->vocab_size;
+    const uint32_t *indices = (const uint32_t*)(base + header->indices_offset);
+    for (uint64_t k = 0; k < header->nnz; k++) {
+        if (indices[k] >= input_size) return 0;
+    }
+    const uint32_t *word_offsets = (const uint32_t*)(base + header->word_offsets_offset);
+    for (uint64_t i = 0; i < vocab_size; i++) {
+        if (word_offsets[i] >= header->strings_size) return 0;
+    }
+    return 1;
+}
+
+// Map a cache file and check its layout
+// Returns NULL if it is missing or from another version, or if it is corrupt (only that is reported)
+static const DatasetCacheHeader* mapDatasetCache(const char *cache_filename, size_t *file_size) {
+    int fd = open(cache_filename, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(DatasetCacheHeader)) {
+        close(fd);
+        return NULL;
+    }
+    *file_size = (size_t)st.st_size;
+    void *mapping = mmap(NULL, *file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // The mapping stays valid after the descriptor is closed
+    if (mapping == MAP_FAILED) {
+        perror("Failed to map dataset cache");
+        return NULL;
+    }
+    const DatasetCacheHeader *header = (const DatasetCacheHeader*)mapping;
+    if (memcmp(header->magic, "EMOTCACH", 8) != 0 || header->version != DATASET_CACHE_VERSION) {
+        munmap(mapping, *file_size);
+        return NULL;
+    }
+    if (!validCache((const char*)mapping, *file_size, header)) {
+        fprintf(stderr, "Corrupt dataset cache '%s': ignoring it.\n", cache_filename);
+        munmap(mapping, *file_size);
+        return NULL;
+    }
+    return header;
+}
+
+// Training set in place in a mapped cache, which it then owns, with the vocabulary (unless vocab_table is NULL),
+// text size and stats; returns NULL, leaving the mapping to the caller, on failure
+static TrainingSet* useDatasetCache(const DatasetCacheHeader *header, size_t file_size, const char *cache_filename,
+                                    StringTable **vocab_table, size_t *text_bytes, VocabStats *stats) {
+    const char *base = (const char*)header;
+
+    // The vocabulary is small next to the rows, so it is interned into a fresh table rather than used in place
+    StringTable *vocab = NULL;
+    if (vocab_table && !header->hash_bits) {
+        const uint32_t *word_offsets = (const uint32_t*)(base + header->word_offsets_offset);
+        const char *strings = base + header->strings_offset;
+        vocab = createStringTable(header->vocab_size);
+        for (int i = 0; vocab && i < header->vocab_size; i++) {
+            const char *word = strings + word_offsets[i];
+            if (stringTableIntern(vocab, word, strlen(word)) != i) {
+                fprintf(stderr, "Corrupt dataset cache '%s': ignoring it.\n", cache_filename);
+                freeStringTable(vocab);
+                vocab = NULL;
+            }
+        }
+        if (!vocab) return NULL;
+    }
+
+    TrainingSet *set = (TrainingSet*)calloc(1, sizeof(TrainingSet));
+    if (!set) {
+        perror("Memory allocation failed for TrainingSet");
+        freeStringTable(vocab);
+        return NULL;
+    }
+    set->num_samples = header->num_samples;
+    set->nnz = header->nnz;
+    set->row_offsets = (size_t*)(base + header->row_offsets_offset);
+    set->indices = (uint32_t*)(base + header->indices_offset);
+    set->counts = (float*)(base + header->counts_offset);
+    set->labels = (uint8_t*)(base + header->labels_offset);
+    set->mapping = (void*)header;
+    set->mapping_size = file_size;
+
+    if (vocab_table) *vocab_table = vocab;
+    if (text_bytes) *text_bytes = header->text_bytes;
+    if (stats) *stats = header->stats;
+    return set;
+}
+
+// Whether the cache was built from exactly this CSV
+static int upToDate(const DatasetCacheHeader *header, const char *csv_filename, const struct stat *csv_stat) {
+    uint64_t csv_hash;
+    return sameFile(header, csv_stat) && hashFilePrefix(csv_filename, header->csv_size, &csv_hash, NULL) && csv_hash == header->csv_hash;
+}
+
+// Whether the CSV is the one the cache was built from with rows appended: it is longer, starts with the
+// same bytes, and those ended with a whole line; compressed CSVs are always ingested in full
+// Once the CSV has more than doubled, a full ingestion costs at most twice as much and ranks every word
+// on its full counts again, so that is done instead
+static int appendedTo(const DatasetCacheHeader *header, const char *csv_filename, const struct stat *csv_stat) {
+    if (header->csv_size == 0 || header->csv_size >= (uint64_t)csv_stat->st_size ||
+        (uint64_t)csv_stat->st_size - header->csv_size > header->csv_size) return 0;
+    // Byte offsets into a compressed file say nothing about where its rows start
+    if (csvCompression(csv_filename) != CSV_PLAIN) return 0;
+    int fd = open(csv_filename, O_RDONLY);
+    if (fd < 0) return 0;
+    char last;
+    int whole_line = pread(fd, &last, 1, (off_t)header->csv_size - 1) == 1 && last == '\n';
+    close(fd);
+    uint64_t csv_hash;
+    return whole_line && hashFilePrefix(csv_filename, header->csv_size, &csv_hash, NULL) && csv_hash == header->csv_hash;
+}
+
+TrainingSet* loadDatasetCache(const char *cache_filename, const char *csv_filename, const struct stat *csv_stat,
+                              const VocabOptions *options, StringTable **vocab_table, size_t *text_bytes, VocabStats *stats) {
+    size_t file_size;
+    const DatasetCacheHeader *header = mapDatasetCache(cache_filename, &file_size);
+    if (!header) return NULL;
+
+    // A different CSV or different options just mean the cache is stale
+    TrainingSet *set = NULL;
+    if (sameOptions(header, options) && upToDate(header, csv_filename, csv_stat)) {
+        set = useDatasetCache(header, file_size, cache_filename, vocab_table, text_bytes, stats);
+    }
+    if (!set) munmap((void*)header, file_size);
+    return set;
+}
+
+// Bring a cache of the start of the CSV up to date by ingesting only the rows appended since, then map the result
+static TrainingSet* appendToDatasetCache(const char *filename, const char *cache_filename, const struct stat *csv_stat,
+                                         const DatasetCacheHeader *header, size_t file_size, const VocabOptions *options,
+                                         StringTable **vocab_table, size_t *text_bytes, VocabStats *stats) {
+    TrainingSet *cached = useDatasetCache(header, file_size, cache_filename, vocab_table, text_bytes, stats);
+    if (!cached) {
+        munmap((void*)header, file_size);
+        return NULL;
+    }
+    TrainingSet *appended = ingestAppendedData(filename, header->csv_size, (int)header->csv_lines, options,
+                                               *vocab_table, text_bytes, stats);
+
+    // Key the result to the whole CSV, unless it changed again while the new rows were read
+    struct stat after;
+    uint64_t csv_hash, csv_lines;
+    int ok = appended && stat(filename, &after) == 0 && after.st_size == csv_stat->st_size &&
+             after.st_mtim.tv_sec == csv_stat->st_mtim.tv_sec && after.st_mtim.tv_nsec == csv_stat->st_mtim.tv_nsec &&
+             hashFilePrefix(filename, (uint64_t)csv_stat->st_size, &csv_hash, &csv_lines);
+    if (ok) {
+        DatasetCacheHeader updated;
+        fillKey(&updated, csv_stat, csv_hash, csv_lines, options);
+        updated.text_bytes = *text_bytes;
+        updated.stats = *stats;
+        const TrainingSet *parts[2] = { cached, appended };
+        ok = writeDatasetCache(cache_filename, &updated, parts, 2, *vocab_table);
+    }
+    int appended_rows = appended ? appended->num_samples : 0;
+    freeTrainingSet(cached);
+    freeTrainingSet(appended);
+
+    // The vocabulary built above is already current, so only the rows are taken from the new cache
+    TrainingSet *set = NULL;
+    if (ok) {
+        header = mapDatasetCache(cache_filename, &file_size);
+        set = header ? useDatasetCache(header, file_size, cache_filename, NULL, NULL, NULL) : NULL;
+        if (header && !set) munmap((void*)header, file_size);
+    }
+    if (!set) {
+        freeStringTable(*vocab_table);
+        *vocab_table = NULL;
+        return NULL;
+    }
+    printf("Added %d appended rows to the pre-tokenized training data in '%s'\n", appended_rows, cache_filename);
+    return set;
+}
+
+TrainingSet* ingestTrainingDataCached(const char *filename, const char *cache_filename, int num_threads, const VocabOptions *options,
+                                      StringTable **vocab_table, size_t *text_bytes, VocabStats *stats) {
+    struct stat before;
+    if (!cache_filename || stat(filename, &before) != 0) {
+        return ingestTrainingData(filename, num_threads, options, vocab_table, text_bytes, stats);
+    }
+    VocabStats local_stats;
+    if (!stats) stats = &local_stats;
+
+    // Use the cache as it is, or ingest just the rows appended since it was written
+    // A pruned vocabulary depends on every row's counts and the cache keeps no record of the words it
+    // dropped, so with any cutoff active a grown CSV is ingested in full
+    size_t file_size;
+    const DatasetCacheHeader *header = mapDatasetCache(cache_filename, &file_size);
+    if (header && sameOptions(header, options)) {
+        if (upToDate(header, filename, &before)) {
+            TrainingSet *set = useDatasetCache(header, file_size, cache_filename, vocab_table, text_bytes, stats);
+            if (set) {
+                printf("Using the pre-tokenized training data in '%s'\n", cache_filename);
+                return set;
+            }
+        }
+        else if (!vocabularyIsPruned(options) && appendedTo(header, filename, &before)) {
+            TrainingSet *set = appendToDatasetCache(filename, cache_filename, &before, header, file_size, options, vocab_table, text_bytes, stats);
+            if (set) return set;
+            header = NULL; // Unmapped by appendToDatasetCache()
+            fprintf(stderr, "Could not add the appended rows to '%s'; reading all of '%s'.\n", cache_filename, filename);
+        }
+    }
+    if (header) munmap((void*)header, file_size);
+
+    TrainingSet *set = ingestTrainingData(filename, num_threads, options, vocab_table, text_bytes, stats);
+    if (!set) return NULL;
+
+    // Only cache what was read if the CSV did not change underneath the ingestion
+    struct stat after;
+    uint64_t csv_hash, csv_lines;
+    if (stat(filename, &after) != 0 || after.st_size != before.st_size ||
+        after.st_mtim.tv_sec != before.st_mtim.tv_sec || after.st_mtim.tv_nsec != before.st_mtim.tv_nsec) {
+        fprintf(stderr, "'%s' changed while it was read; not caching it.\n", filename);
+        return set;
+    }
+    if (hashFilePrefix(filename, (uint64_t)before.st_size, &csv_hash, &csv_lines) &&
+        saveDatasetCache(cache_filename, &before, csv_hash, csv_lines, options, set, *vocab_table, *text_bytes, stats)) {
+        printf("Saved the pre-tokenized training data to '%s'\n", cache_filename);
+    }
+    return set;
+}
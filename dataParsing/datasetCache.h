@@ -0,0 +1,37 @@
+#ifndef DATASETCACHE_H
+#define DATASETCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "ingest.h"
+
+// Pre-tokenized copy of ingestTrainingData()'s result: vocabulary, CSR rows and labels
+// The file is keyed by the CSV's size, modification time and a hash of its bytes, and by the
+// vocabulary options; it is only reused when all of them match, or extended when the CSV has only grown. The CSR arrays are used in place
+// from a read-only mapping, so training can start without re-reading the CSV.
+// Cache files are written in the machine's native layout and are not meant to be moved between machines.
+
+// Write the training set and vocabulary (NULL when feature hashing) for the CSV described by csv_stat,
+// whose bytes have hashFilePrefix() csv_hash and csv_lines lines; returns 0 on failure
+int saveDatasetCache(const char *cache_filename, const struct stat *csv_stat, uint64_t csv_hash, uint64_t csv_lines, const VocabOptions *options,
+                     const TrainingSet *set, const StringTable *vocab_table, size_t text_bytes, const VocabStats *stats);
+
+// Map the cache if it matches the CSV and options; the returned set is read-only and points into the mapping
+// Returns NULL if the cache is missing, stale or corrupt; only a corrupt cache prints an error
+TrainingSet* loadDatasetCache(const char *cache_filename, const char *csv_filename, const struct stat *csv_stat,
+                              const VocabOptions *options, StringTable **vocab_table, size_t *text_bytes, VocabStats *stats);
+
+// 64-bit hash of the first size bytes of a file, as stored in the cache, and their line count (lines may be NULL)
+// Returns 0 on failure
+int hashFilePrefix(const char *filename, uint64_t size, uint64_t *hash, uint64_t *lines);
+
+// ingestTrainingData() through the cache: use cache_filename when it matches, otherwise ingest the CSV
+// and write the cache for next time (a NULL cache_filename always ingests)
+// When the CSV has only grown by appended rows, only those are ingested (see ingestAppendedData()) and
+// added to the cache: parsing and tokenizing then cost only as much as the new rows (the whole CSV is still hashed)
+// This needs a vocabulary without cutoffs (see vocabularyIsPruned()); a pruned one is rebuilt from the whole CSV
+TrainingSet* ingestTrainingDataCached(const char *filename, const char *cache_filename, int num_threads, const VocabOptions *options,
+                                      StringTable **vocab_table, size_t *text_bytes, VocabStats *stats);
+
+#endif
@@ -0,0 +1,272 @@
+#include "decompressStream.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// Compressed bytes read from the file at a time
+#define COMPRESSED_BUFFER_SIZE (64 * 1024)
+
+CsvCompression csvCompression(const char *filename) {
+    unsigned char magic[4] = {0};
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return CSV_PLAIN; // The parser reports it
+    size_t got = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+    if (got >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) return CSV_GZIP;
+    if (got == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) return CSV_ZSTD;
+    return CSV_PLAIN;
+}
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+// Wait for a free block; returns its index, or -1 if the consumer is closing the stream
+static int claimBlock(DecompressStream *stream) {
+    pthread_mutex_lock(&stream->lock);
+    while (!stream->stopping && stream->produced - stream->consumed == DECOMPRESS_BLOCKS) {
+        pthread_cond_wait(&stream->changed, &stream->lock);
+    }
+    int block = stream->stopping ? -1 : (int)(stream->produced % DECOMPRESS_BLOCKS);
+    pthread_mutex_unlock(&stream->lock);
+    return block;
+}
+
+// Hand a filled block to the consumer
+static void publishBlock(DecompressStream *stream, int block, size_t length) {
+    pthread_mutex_lock(&stream->lock);
+    stream->lengths[block] = length;
+    stream->produced++;
+    pthread_cond_broadcast(&stream->changed);
+    pthread_mutex_unlock(&stream->lock);
+}
+#endif
+
+#ifdef HAVE_ZLIB
+// Inflate every gzip member of the file into the ring, block by block
+static int inflateInto(DecompressStream *stream, unsigned char *input) {
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (inflateInit2(&z, 15 + 32) != Z_OK) { // 15 + 32: gzip or zlib header, detected automatically
+        fprintf(stderr, "Failed to start gzip decompression.\n");
+        return 0;
+    }
+    int ok = 1;
+    int at_end = 0; // Input exhausted
+    int in_member = 0; // Between a member's first byte and its end
+    while (ok && !at_end) {
+        int block = claimBlock(stream);
+        if (block < 0) break;
+        z.next_out = (unsigned char*)stream->blocks + (size_t)block * DECOMPRESS_BLOCK_SIZE;
+        z.avail_out = DECOMPRESS_BLOCK_SIZE;
+        while (ok && z.avail_out > 0) {
+            if (z.avail_in == 0) {
+                z.avail_in = (uInt)fread(input, 1, COMPRESSED_BUFFER_SIZE, stream->fp);
+                z.next_in = input;
+                if (z.avail_in == 0) {
+                    if (ferror(stream->fp)) {
+                        perror("Error reading compressed file");
+                        ok = 0;
+                    }
+                    else if (in_member) {
+                        fprintf(stderr, "Compressed file is truncated.\n");
+                        ok = 0;
+                    }
+                    at_end = 1;
+                    break;
+                }
+            }
+            in_member = 1;
+            int status = inflate(&z, Z_NO_FLUSH);
+            if (status == Z_STREAM_END) {
+                // Concatenated members (e.g. from appending with gzip >>) follow one another
+                inflateReset(&z);
+                in_member = 0;
+            }
+            else if (status != Z_OK && status != Z_BUF_ERROR) {
+                fprintf(stderr, "Corrupt gzip data: %s.\n", z.msg ? z.msg : "inflate failed");
+                ok = 0;
+            }
+        }
+        publishBlock(stream, block, DECOMPRESS_BLOCK_SIZE - z.avail_out);
+    }
+    inflateEnd(&z);
+    return ok;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+// Decompress every zstd frame of the file into the ring, block by block
+static int zstdInto(DecompressStream *stream, unsigned char *input) {
+    ZSTD_DStream *z = ZSTD_createDStream();
+    if (!z) {
+        fprintf(stderr, "Failed to start zstd decompression.\n");
+        return 0;
+    }
+    ZSTD_inBuffer in = { input, 0, 0 };
+    int ok = 1;
+    int at_end = 0;
+    int input_done = 0; // The whole file has been read; the decoder may still hold output
+    size_t pending = 0; // Non-zero while a frame is unfinished
+    while (ok && !at_end) {
+        int block = claimBlock(stream);
+        if (block < 0) break;
+        ZSTD_outBuffer out = { stream->blocks + (size_t)block * DECOMPRESS_BLOCK_SIZE, DECOMPRESS_BLOCK_SIZE, 0 };
+        while (ok && out.pos < out.size) {
+            if (in.pos == in.size && !input_done) {
+                in.size = fread(input, 1, COMPRESSED_BUFFER_SIZE, stream->fp);
+                in.pos = 0;
+                if (in.size == 0) {
+                    if (ferror(stream->fp)) {
+                        perror("Error reading compressed file");
+                        ok = 0;
+                        break;
+                    }
+                    input_done = 1;
+                }
+            }
+            size_t produced = out.pos;
+            size_t status = ZSTD_decompressStream(z, &out, &in);
+            if (ZSTD_isError(status)) {
+                fprintf(stderr, "Corrupt zstd data: %s.\n", ZSTD_getErrorName(status));
+                ok = 0;
+            }
+            else if (!input_done || out.pos > produced) {
+                pending = status;
+            }
+            else {
+                // Flushed everything the decoder held; only now does an unfinished frame mean a short file
+                // (a call without input or output says nothing about the frame, so pending is left as it was)
+                if (pending) {
+                    fprintf(stderr, "Compressed file is truncated.\n");
+                    ok = 0;
+                }
+                at_end = 1;
+                break;
+            }
+        }
+        publishBlock(stream, block, out.pos);
+    }
+    ZSTD_freeDStream(z);
+    return ok;
+}
+#endif
+
+static void* decompressWorker(void *arg) {
+    DecompressStream *stream = (DecompressStream*)arg;
+    unsigned char *input = (unsigned char*)malloc(COMPRESSED_BUFFER_SIZE);
+    int ok = 0;
+    if (!input) {
+        perror("Memory allocation failed for decompression");
+    }
+#ifdef HAVE_ZLIB
+    else if (stream->compression == CSV_GZIP) {
+        ok = inflateInto(stream, input);
+    }
+#endif
+#ifdef HAVE_ZSTD
+    else if (stream->compression == CSV_ZSTD) {
+        ok = zstdInto(stream, input);
+    }
+#endif
+    free(input);
+
+    pthread_mutex_lock(&stream->lock);
+    stream->finished = 1;
+    stream->failed = !ok;
+    pthread_cond_broadcast(&stream->changed);
+    pthread_mutex_unlock(&stream->lock);
+    return NULL;
+}
+
+DecompressStream* openDecompressStream(const char *filename, CsvCompression compression) {
+#ifndef HAVE_ZLIB
+    if (compression == CSV_GZIP) {
+        fprintf(stderr, "'%s' is gzip-compressed, but this build has no gzip support (build with GZIP=1, which needs zlib).\n", filename);
+        return NULL;
+    }
+#endif
+#ifndef HAVE_ZSTD
+    if (compression == CSV_ZSTD) {
+        fprintf(stderr, "'%s' is zstd-compressed, but this build has no zstd support (build with ZSTD=1).\n", filename);
+        return NULL;
+    }
+#endif
+    DecompressStream *stream = (DecompressStream*)calloc(1, sizeof(DecompressStream));
+    if (!stream) {
+        perror("Memory allocation failed for DecompressStream");
+        return NULL;
+    }
+    stream->compression = compression;
+    stream->fp = fopen(filename, "rb");
+    if (!stream->fp) {
+        perror("Error opening compressed file");
+        free(stream);
+        return NULL;
+    }
+    stream->blocks = (char*)malloc((size_t)DECOMPRESS_BLOCKS * DECOMPRESS_BLOCK_SIZE);
+    if (!stream->blocks) {
+        perror("Memory allocation failed for DecompressStream");
+        fclose(stream->fp);
+        free(stream);
+        return NULL;
+    }
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->changed, NULL);
+    if (pthread_create(&stream->thread, NULL, decompressWorker, stream) != 0) {
+        fprintf(stderr, "Failed to start the decompression thread.\n");
+        pthread_mutex_destroy(&stream->lock);
+        pthread_cond_destroy(&stream->changed);
+        free(stream->blocks);
+        fclose(stream->fp);
+        free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+int decompressStreamNext(DecompressStream *stream, const char **bytes, size_t *n) {
+    pthread_mutex_lock(&stream->lock);
+    while (stream->produced == stream->consumed && !stream->finished) {
+        pthread_cond_wait(&stream->changed, &stream->lock);
+    }
+    int result;
+    if (stream->produced > stream->consumed) {
+        // Blocks filled before an error are still handed out; the error follows them
+        int block = (int)(stream->consumed % DECOMPRESS_BLOCKS);
+        *bytes = stream->blocks + (size_t)block * DECOMPRESS_BLOCK_SIZE;
+        *n = stream->lengths[block];
+        result = 1;
+    }
+    else {
+        result = stream->failed ? -1 : 0;
+    }
+    pthread_mutex_unlock(&stream->lock);
+    return result;
+}
+
+void decompressStreamRelease(DecompressStream *stream) {
+    pthread_mutex_lock(&stream->lock);
+    stream->consumed++;
+    pthread_cond_broadcast(&stream->changed);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+int closeDecompressStream(DecompressStream *stream) {
+    if (!stream) return 1;
+    pthread_mutex_lock(&stream->lock);
+    stream->stopping = 1;
+    pthread_cond_broadcast(&stream->changed);
+    pthread_mutex_unlock(&stream->lock);
+    pthread_join(stream->thread, NULL);
+
+    int ok = !stream->failed;
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->changed);
+    free(stream->blocks);
+    fclose(stream->fp);
+    free(stream);
+    return ok;
+}
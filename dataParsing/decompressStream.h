@@ -0,0 +1,51 @@
+#ifndef DECOMPRESSSTREAM_H
+#define DECOMPRESSSTREAM_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// How a CSV file is stored, from its first bytes
+typedef enum {
+    CSV_PLAIN = 0,
+    CSV_GZIP = 1, // Needs a build with GZIP=1, which links zlib
+    CSV_ZSTD = 2  // Needs a build with ZSTD=1, which links libzstd
+} CsvCompression;
+
+CsvCompression csvCompression(const char *filename);
+
+// Decompressed bytes are handed over in blocks through a ring of this many
+#define DECOMPRESS_BLOCKS 8
+#define DECOMPRESS_BLOCK_SIZE (256 * 1024)
+
+// A compressed file decompressed on a producer thread of its own
+// The producer fills the ring's blocks in order while the consumer parses earlier ones in place,
+// so decompression overlaps parsing and the uncompressed data never touches the disk.
+typedef struct {
+    FILE *fp;
+    CsvCompression compression;
+    char *blocks;                        // DECOMPRESS_BLOCKS blocks of DECOMPRESS_BLOCK_SIZE bytes
+    size_t lengths[DECOMPRESS_BLOCKS];   // Bytes filled in each block
+    uint64_t produced;                   // Blocks filled so far
+    uint64_t consumed;                   // Blocks released so far
+    int finished;                        // The producer reached the end of the data
+    int failed;                          // The producer hit an error (already reported)
+    int stopping;                        // The consumer is closing the stream early
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    pthread_t thread;
+} DecompressStream;
+
+// Open a compressed file and start decompressing it; returns NULL on failure
+DecompressStream* openDecompressStream(const char *filename, CsvCompression compression);
+
+// Wait for the next block of decompressed bytes; returns 1 with *bytes and *n set, 0 at the end of the data
+// and -1 on error. The block stays valid until decompressStreamRelease()
+int decompressStreamNext(DecompressStream *stream, const char **bytes, size_t *n);
+void decompressStreamRelease(DecompressStream *stream);
+
+// Stop the producer and free the stream; returns 0 if decompression failed
+int closeDecompressStream(DecompressStream *stream);
+
+#endif
@@ -0,0 +1,170 @@
+#include "heavyHitters.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Finalizer from MurmurHash3; FNV's low bits alone make poor slot indices
+static inline uint64_t mixHash(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+HeavyHitters* createHeavyHitters(int capacity) {
+    HeavyHitters *sketch = (HeavyHitters*)calloc(1, sizeof(HeavyHitters));
+    if (!sketch) {
+        perror("Memory allocation failed for HeavyHitters");
+        return NULL;
+    }
+
+    // Keep the load factor at or below one half
+    uint32_t slot_count = 16;
+    while (slot_count < 2 * (uint32_t)capacity) slot_count *= 2;
+    sketch->capacity = capacity;
+    sketch->entries = (HeavyHitter*)calloc(capacity, sizeof(HeavyHitter));
+    sketch->heap = (int*)malloc(capacity * sizeof(int));
+    sketch->slots = (uint32_t*)calloc(slot_count, sizeof(uint32_t));
+    sketch->mask = slot_count - 1;
+    if (!sketch->entries || !sketch->heap || !sketch->slots) {
+        perror("Memory allocation failed for HeavyHitters");
+        freeHeavyHitters(sketch);
+        return NULL;
+    }
+    return sketch;
+}
+
+void freeHeavyHitters(HeavyHitters *sketch) {
+    if (!sketch) return;
+    for (int i = 0; sketch->entries && i < sketch->count; i++) {
+        free(sketch->entries[i].word);
+    }
+    free(sketch->entries);
+    free(sketch->heap);
+    free(sketch->slots);
+    free(sketch);
+}
+
+// Restore the heap below position pos after its count grew
+static void siftDown(HeavyHitters *sketch, int pos) {
+    int *heap = sketch->heap;
+    HeavyHitter *entries = sketch->entries;
+    int n = sketch->count;
+    int moving = heap[pos];
+    for (;;) {
+        int child = 2 * pos + 1;
+        if (child >= n) break;
+        if (child + 1 < n && entries[heap[child + 1]].count < entries[heap[child]].count) child++;
+        if (entries[heap[child]].count >= entries[moving].count) break;
+        heap[pos] = heap[child];
+        entries[heap[pos]].heap_pos = pos;
+        pos = child;
+    }
+    heap[pos] = moving;
+    entries[moving].heap_pos = pos;
+}
+
+// Restore the heap above position pos; new entries start at the bottom
+static void siftUp(HeavyHitters *sketch, int pos) {
+    int *heap = sketch->heap;
+    HeavyHitter *entries = sketch->entries;
+    int moving = heap[pos];
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (entries[heap[parent]].count <= entries[moving].count) break;
+        heap[pos] = heap[parent];
+        entries[heap[pos]].heap_pos = pos;
+        pos = parent;
+    }
+    heap[pos] = moving;
+    entries[moving].heap_pos = pos;
+}
+
+// Slot holding the word, or the empty slot where it would go
+static uint32_t findSlot(const HeavyHitters *sketch, const char *word, size_t length, uint64_t hash) {
+    for (uint32_t i = (uint32_t)mixHash(hash) & sketch->mask;; i = (i + 1) & sketch->mask) {
+        uint32_t slot = sketch->slots[i];
+        if (slot == 0) return i;
+        const HeavyHitter *entry = &sketch->entries[slot - 1];
+        if (entry->hash == hash && entry->length == length && memcmp(entry->word, word, length) == 0) return i;
+    }
+}
+
+// Empty a slot, moving later entries of its probe run back so lookups still find them
+static void removeSlot(HeavyHitters *sketch, uint32_t i) {
+    uint32_t mask = sketch->mask;
+    uint32_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        uint32_t slot = sketch->slots[j];
+        if (slot == 0) break;
+        uint32_t home = (uint32_t)mixHash(sketch->entries[slot - 1].hash) & mask;
+        // Move it back unless its home lies cyclically in (i, j]
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            sketch->slots[i] = slot;
+            i = j;
+        }
+    }
+    sketch->slots[i] = 0;
+}
+
+static int setWord(HeavyHitter *entry, const char *word, size_t length, uint64_t hash) {
+    if (entry->word_capacity < length + 1) {
+        char *copy = (char*)realloc(entry->word, length + 1);
+        if (!copy) {
+            perror("Memory allocation failed for heavy hitter word");
+            return 0;
+        }
+        entry->word = copy;
+        entry->word_capacity = (uint32_t)(length + 1);
+    }
+    memcpy(entry->word, word, length);
+    entry->word[length] = '\0';
+    entry->length = (uint32_t)length;
+    entry->hash = hash;
+    return 1;
+}
+
+int heavyHittersAdd(HeavyHitters *sketch, const char *word, size_t length, uint64_t hash) {
+    sketch->total++;
+    uint32_t i = findSlot(sketch, word, length, hash);
+    if (sketch->slots[i] != 0) {
+        HeavyHitter *entry = &sketch->entries[sketch->slots[i] - 1];
+        entry->count++;
+        if (entry->last_row != sketch->row + 1) {
+            entry->docs++;
+            entry->last_row = sketch->row + 1;
+        }
+        siftDown(sketch, entry->heap_pos);
+        return 1;
+    }
+
+    int index;
+    uint64_t inherited = 0;
+    if (sketch->count < sketch->capacity) {
+        index = sketch->count++;
+        sketch->heap[index] = index;
+        sketch->entries[index].heap_pos = index;
+    }
+    else {
+        // Take over the entry with the lowest count
+        index = sketch->heap[0];
+        HeavyHitter *victim = &sketch->entries[index];
+        inherited = victim->count;
+        removeSlot(sketch, findSlot(sketch, victim->word, victim->length, victim->hash));
+        i = findSlot(sketch, word, length, hash);
+    }
+
+    HeavyHitter *entry = &sketch->entries[index];
+    if (!setWord(entry, word, length, hash)) return 0;
+    entry->count = inherited + 1;
+    entry->error = inherited;
+    entry->docs = 1;
+    entry->last_row = sketch->row + 1;
+    sketch->slots[i] = (uint32_t)index + 1;
+    if (inherited) siftDown(sketch, entry->heap_pos);
+    else siftUp(sketch, entry->heap_pos);
+    return 1;
+}
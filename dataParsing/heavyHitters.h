@@ -0,0 +1,47 @@
+#ifndef HEAVYHITTERS_H
+#define HEAVYHITTERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Word tracked by the sketch
+typedef struct {
+    char *word;          // Own copy, NUL-terminated; reused when the entry is taken over by another word
+    uint32_t length;
+    uint32_t word_capacity;
+    uint64_t hash;
+    uint64_t count;      // Estimated occurrences; overestimates by at most error
+    uint64_t error;      // Count of the word this entry replaced
+    uint64_t docs;       // Rows the word was seen in since it entered the sketch
+    uint64_t last_row;   // Last row it was seen in, plus one
+    int heap_pos;
+} HeavyHitter;
+
+// Space-saving heavy-hitter sketch over a stream of words, in memory fixed at creation
+// It tracks at most capacity words. A new word replaces the one with the lowest count and inherits
+// that count, so every word occurring more than total / capacity times is guaranteed to be tracked
+// and no count is more than total / capacity too high. Entries sit in a min-heap on count and
+// are found through a linear-probing table keyed by the tokenizer hash.
+typedef struct {
+    HeavyHitter *entries;
+    int capacity;
+    int count;
+    int *heap;           // Entry indices, lowest count first
+    uint32_t *slots;     // Entry index + 1, or 0 when empty
+    uint32_t mask;
+    uint64_t total;      // Words added
+    uint64_t row;        // Rows started
+} HeavyHitters;
+
+HeavyHitters* createHeavyHitters(int capacity);
+void freeHeavyHitters(HeavyHitters *sketch);
+
+// Start a new row, for the document counts
+static inline void heavyHittersNextRow(HeavyHitters *sketch) {
+    sketch->row++;
+}
+
+// Count one occurrence of a word with its stringTableHash() (Token.hash); returns 0 if memory runs out
+int heavyHittersAdd(HeavyHitters *sketch, const char *word, size_t length, uint64_t hash);
+
+#endif
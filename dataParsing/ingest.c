@@ -0,0 +1,640 @@
+#include "ingest.h"
+#include "dataParser.h"
+#include "tokenizer.h"
+#include "heavyHitters.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A word of one range's vocabulary, queued for the shard that owns it
+typedef struct {
+    uint64_t hash;
+    uint32_t local_id;
+    uint32_t shard_id;    // Its id in the shard, once merged
+} QueuedWord;
+
+// One contiguous range of the file: its rows with word ids local to the range
+typedef struct {
+    StringTable *words;   // Local vocabulary, in order of first appearance in the range
+    uint64_t *counts;     // Occurrences per local id
+    uint64_t *hashes;     // Word hash per local id
+    uint32_t *docs;       // Rows containing each local id
+    int capacity;
+    TrainingSet *set;
+    size_t text_bytes;
+    QueuedWord *queued;   // Local words grouped by shard
+    int shard_begin[MAX_PARSE_THREADS + 1];
+    int num_shards;
+    uint32_t *remap;      // Local id -> final id, or PRUNED_ID
+    size_t kept_nnz;      // Entries left once pruned words are dropped
+    TrainingSet *out;     // Final set and where this range's rows go in it
+    int first_sample;
+    size_t first_nnz;
+    struct VocabShard *shards;
+    int hash_bits;        // Feature hashing: rows hold buckets and there is no local vocabulary
+    const StringTable *fixed_vocab; // Vocabulary chosen beforehand: rows hold its ids and other words are dropped
+    uint32_t new_word_flag; // With fixed_vocab: other words are counted locally instead, their ids tagged with this
+    int ok;
+} IngestRange;
+
+// A word in a shard's merged vocabulary, as sorted for the final ids
+typedef struct {
+    uint64_t count;
+    uint64_t docs;
+    const char *word;
+    uint32_t length;
+    uint32_t shard_id;
+} VocabEntry;
+
+// Words whose hash falls in one shard, merged over every range
+typedef struct VocabShard {
+    int index;
+    IngestRange *ranges;
+    int num_ranges;
+    StringTable *words;
+    VocabEntry *entries;  // Indexed by shard id, then sorted
+    int capacity;
+    uint32_t *final_ids;  // Final id per shard id
+    int ok;
+} VocabShard;
+
+// Final id of a word removed by a cutoff
+#define PRUNED_ID UINT32_MAX
+
+// Tags the local ids of new words in rows appended to an existing vocabulary
+#define NEW_WORD_ID 0x80000000u
+
+static inline int shardOf(uint64_t hash, int num_shards) {
+    // Multiply so the high bits, which FNV mixes best, pick the shard
+    return (int)(((hash * 0x9E3779B97F4A7C15ULL) >> 32) % (uint64_t)num_shards);
+}
+
+// Most frequent first, then byte order; a prefix sorts before the longer word
+static int compareEntries(const VocabEntry *a, const VocabEntry *b) {
+    if (a->count != b->count) return a->count > b->count ? -1 : 1;
+    uint32_t n = a->length < b->length ? a->length : b->length;
+    int c = memcmp(a->word, b->word, n);
+    if (c != 0) return c;
+    return (a->length > b->length) - (a->length < b->length);
+}
+
+static int compareEntriesQsort(const void *a, const void *b) {
+    return compareEntries((const VocabEntry*)a, (const VocabEntry*)b);
+}
+
+// Run fn once per item, each on a thread of its own (inline when there is only one)
+// An item whose thread cannot be started runs on the calling thread once the others are joined
+static void runParallel(void *(*fn)(void*), void *items, size_t item_size, int count) {
+    if (count == 1) {
+        fn(items);
+        return;
+    }
+    pthread_t threads[MAX_PARSE_THREADS];
+    int started[MAX_PARSE_THREADS];
+    for (int i = 0; i < count; i++) {
+        started[i] = pthread_create(&threads[i], NULL, fn, (char*)items + i * item_size) == 0;
+        if (!started[i]) {
+            fprintf(stderr, "Failed to start ingestion thread %d, running its work inline.\n", i);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+        else {
+            fn((char*)items + i * item_size);
+        }
+    }
+}
+
+// Tokenize one row once, counting its words in the range's vocabulary and adding their ids to the row
+static int ingestRecord(const char *text, uint32_t length, uint8_t label, void *arg) {
+    IngestRange *range = (IngestRange*)arg;
+    Tokenizer tokenizer;
+    Token token;
+    tokenizerInit(&tokenizer, text, length);
+    while (nextToken(&tokenizer, &token)) {
+        if (range->hash_bits) {
+            if (!trainingSetAddToken(range->set, featureHashBucket(token.hash, range->hash_bits))) return 0;
+            continue;
+        }
+        if (range->fixed_vocab) {
+            int id = stringTableFindHashed(range->fixed_vocab, token.lower, token.length, token.hash);
+            if (id >= 0) {
+                if (!trainingSetAddToken(range->set, (uint32_t)id)) return 0;
+                continue;
+            }
+            if (!range->new_word_flag) continue;
+        }
+        int known = range->words->count;
+        int id = stringTableInternHashed(range->words, token.lower, token.length, token.hash);
+        if (id < 0) return 0;
+        if (id == range->capacity) {
+            int capacity = range->capacity * 2;
+            uint64_t *counts = (uint64_t*)realloc(range->counts, capacity * sizeof(uint64_t));
+            if (!counts) {
+                perror("Reallocation failed for word counts");
+                return 0;
+            }
+            range->counts = counts;
+            uint64_t *hashes = (uint64_t*)realloc(range->hashes, capacity * sizeof(uint64_t));
+            if (!hashes) {
+                perror("Reallocation failed for word counts");
+                return 0;
+            }
+            range->hashes = hashes;
+            range->capacity = capacity;
+        }
+        if (id == known) {
+            range->counts[id] = 0;
+            range->hashes[id] = token.hash;
+        }
+        range->counts[id]++;
+        if (!trainingSetAddToken(range->set, (uint32_t)id | range->new_word_flag)) return 0;
+    }
+    range->text_bytes += length;
+    return trainingSetEndRow(range->set, label);
+}
+
+// Group the range's words by shard (a counting sort on the shard index)
+static void* queueRangeWords(void *arg) {
+    IngestRange *range = (IngestRange*)arg;
+    int num_words = range->words->count;
+    range->ok = 0;
+    range->queued = (QueuedWord*)malloc((num_words > 0 ? num_words : 1) * sizeof(QueuedWord));
+    range->docs = (uint32_t*)calloc(num_words > 0 ? num_words : 1, sizeof(uint32_t));
+    if (!range->queued || !range->docs) {
+        perror("Memory allocation failed for vocabulary merge");
+        return NULL;
+    }
+
+    // Rows hold each id at most once, so this counts the rows containing it
+    for (size_t k = 0; k < range->set->nnz; k++) {
+        range->docs[range->set->indices[k]]++;
+    }
+
+    int fill[MAX_PARSE_THREADS + 1] = {0};
+    for (int id = 0; id < num_words; id++) {
+        fill[shardOf(range->hashes[id], range->num_shards) + 1]++;
+    }
+    for (int s = 0; s < range->num_shards; s++) {
+        fill[s + 1] += fill[s];
+    }
+    memcpy(range->shard_begin, fill, (range->num_shards + 1) * sizeof(int));
+    for (int id = 0; id < num_words; id++) {
+        int s = shardOf(range->hashes[id], range->num_shards);
+        range->queued[fill[s]++] = (QueuedWord){ .hash = range->hashes[id], .local_id = (uint32_t)id };
+    }
+    range->ok = 1;
+    return NULL;
+}
+
+// Merge one shard's words from every range, summing their counts, then sort them
+static void* mergeShard(void *arg) {
+    VocabShard *shard = (VocabShard*)arg;
+    shard->ok = 0;
+    shard->words = createStringTable(1024);
+    shard->capacity = 1024;
+    shard->entries = (VocabEntry*)malloc(shard->capacity * sizeof(VocabEntry));
+    if (!shard->words || !shard->entries) {
+        perror("Memory allocation failed for vocabulary shard");
+        return NULL;
+    }
+
+    for (int r = 0; r < shard->num_ranges; r++) {
+        IngestRange *range = &shard->ranges[r];
+        for (int q = range->shard_begin[shard->index]; q < range->shard_begin[shard->index + 1]; q++) {
+            QueuedWord *queued = &range->queued[q];
+            const char *word = range->words->words[queued->local_id];
+            uint32_t length = range->words->lengths[queued->local_id];
+            int known = shard->words->count;
+            int id = stringTableInternHashed(shard->words, word, length, queued->hash);
+            if (id < 0) return NULL;
+            if (id == shard->capacity) {
+                int capacity = shard->capacity * 2;
+                VocabEntry *entries = (VocabEntry*)realloc(shard->entries, capacity * sizeof(VocabEntry));
+                if (!entries) {
+                    perror("Reallocation failed for vocabulary shard");
+                    return NULL;
+                }
+                shard->entries = entries;
+                shard->capacity = capacity;
+            }
+            if (id == known) {
+                shard->entries[id] = (VocabEntry){ .count = 0, .docs = 0, .word = shard->words->words[id], .length = length, .shard_id = (uint32_t)id };
+            }
+            shard->entries[id].count += range->counts[queued->local_id];
+            shard->entries[id].docs += range->docs[queued->local_id];
+            queued->shard_id = (uint32_t)id;
+        }
+    }
+
+    qsort(shard->entries, shard->words->count, sizeof(VocabEntry), compareEntriesQsort);
+    shard->final_ids = (uint32_t*)malloc((shard->words->count > 0 ? shard->words->count : 1) * sizeof(uint32_t));
+    if (!shard->final_ids) {
+        perror("Memory allocation failed for vocabulary shard");
+        return NULL;
+    }
+    shard->ok = 1;
+    return NULL;
+}
+
+// Look up the range's final ids and count the entries that survive pruning
+static void* remapRange(void *arg) {
+    IngestRange *range = (IngestRange*)arg;
+    range->ok = 0;
+    range->remap = (uint32_t*)malloc((range->words->count > 0 ? range->words->count : 1) * sizeof(uint32_t));
+    if (!range->remap) {
+        perror("Memory allocation failed for vocabulary merge");
+        return NULL;
+    }
+    for (int s = 0; s < range->num_shards; s++) {
+        const uint32_t *final_ids = range->shards[s].final_ids;
+        for (int q = range->shard_begin[s]; q < range->shard_begin[s + 1]; q++) {
+            range->remap[range->queued[q].local_id] = final_ids[range->queued[q].shard_id];
+        }
+    }
+
+    range->kept_nnz = 0;
+    for (size_t k = 0; k < range->set->nnz; k++) {
+        if (range->remap[range->set->indices[k]] != PRUNED_ID) range->kept_nnz++;
+    }
+    range->ok = 1;
+    return NULL;
+}
+
+// Copy the range's rows into their place in the final set, with final ids and without pruned words
+// Feature-hashed rows have no remap and are copied as they are
+static void* emitRange(void *arg) {
+    IngestRange *range = (IngestRange*)arg;
+    const TrainingSet *set = range->set;
+    TrainingSet *out = range->out;
+    size_t nnz = range->first_nnz;
+    for (int i = 0; i < set->num_samples; i++) {
+        for (size_t k = set->row_offsets[i]; k < set->row_offsets[i + 1]; k++) {
+            uint32_t id = range->remap ? range->remap[set->indices[k]] : set->indices[k];
+            if (id == PRUNED_ID) continue;
+            out->indices[nnz] = id;
+            out->counts[nnz] = set->counts[k];
+            nnz++;
+        }
+        out->row_offsets[range->first_sample + i + 1] = nnz;
+    }
+    memcpy(out->labels + range->first_sample, set->labels, set->num_samples * sizeof(uint8_t));
+    return NULL;
+}
+
+static void freeRange(IngestRange *range) {
+    freeStringTable(range->words);
+    free(range->counts);
+    free(range->hashes);
+    free(range->docs);
+    freeTrainingSet(range->set);
+    free(range->queued);
+    free(range->remap);
+}
+
+// Which cutoff, if any, removes a word; entries arrive most frequent first, after kept words have been kept
+static int pruneCutoff(const VocabEntry *entry, const VocabOptions *options, int kept, int num_rows) {
+    if (!options) return -1;
+    if (entry->count < options->min_count) return PRUNE_MIN_COUNT;
+    if (options->max_doc_fraction > 0.0 && entry->docs > options->max_doc_fraction * num_rows) return PRUNE_MAX_DOC_FRACTION;
+    if (options->max_words > 0 && kept >= options->max_words) return PRUNE_MAX_WORDS;
+    return -1;
+}
+
+// Whether options can leave words out of the vocabulary (feature hashing builds none to prune)
+int vocabularyIsPruned(const VocabOptions *options) {
+    if (!options || options->hash_bits > 0) return 0;
+    return options->min_count > 1 || options->max_doc_fraction > 0.0 || options->max_words > 0 || options->sketch_words > 0;
+}
+
+static int sketchRecord(const char *text, uint32_t length, uint8_t label, void *arg) {
+    HeavyHitters *sketch = (HeavyHitters*)arg;
+    Tokenizer tokenizer;
+    Token token;
+    (void)label;
+    heavyHittersNextRow(sketch);
+    tokenizerInit(&tokenizer, text, length);
+    while (nextToken(&tokenizer, &token)) {
+        if (!heavyHittersAdd(sketch, token.lower, token.length, token.hash)) return 0;
+    }
+    return 1;
+}
+
+// Choose the vocabulary in one streaming pass with memory bounded by options->sketch_words
+// Counts are the sketch's estimates, so the cutoffs apply to them; words it never kept cannot be chosen
+static StringTable* sketchVocabulary(const char *filename, const VocabOptions *options, VocabStats *stats) {
+    HeavyHitters *sketch = createHeavyHitters(options->sketch_words);
+    if (!sketch) return NULL;
+    if (parseCSVRecords(filename, sketchRecord, sketch) < 0) {
+        freeHeavyHitters(sketch);
+        return NULL;
+    }
+
+    VocabEntry *entries = (VocabEntry*)malloc((sketch->count > 0 ? sketch->count : 1) * sizeof(VocabEntry));
+    int expected = options->max_words > 0 && options->max_words < sketch->count ? options->max_words : sketch->count;
+    StringTable *vocab = createStringTable(expected);
+    if (!entries || !vocab) {
+        perror("Memory allocation failed for sketched vocabulary");
+        free(entries);
+        freeStringTable(vocab);
+        freeHeavyHitters(sketch);
+        return NULL;
+    }
+    for (int i = 0; i < sketch->count; i++) {
+        const HeavyHitter *hitter = &sketch->entries[i];
+        entries[i] = (VocabEntry){ .count = hitter->count, .docs = hitter->docs, .word = hitter->word, .length = hitter->length };
+    }
+    qsort(entries, sketch->count, sizeof(VocabEntry), compareEntriesQsort);
+
+    stats->distinct_words = sketch->count;
+    stats->total_tokens = sketch->total;
+    stats->sketch_words = sketch->capacity;
+    stats->sketch_max_error = sketch->total / (uint64_t)sketch->capacity;
+    for (int i = 0; i < sketch->count; i++) {
+        const VocabEntry *entry = &entries[i];
+        int cutoff = pruneCutoff(entry, options, vocab->count, (int)sketch->row);
+        if (cutoff >= 0) {
+            stats->removed_words[cutoff]++;
+            stats->removed_tokens[cutoff] += entry->count;
+            stats->removed_string_bytes[cutoff] += entry->length + 1;
+        }
+        else if (stringTableIntern(vocab, entry->word, entry->length) < 0) {
+            free(entries);
+            freeStringTable(vocab);
+            freeHeavyHitters(sketch);
+            return NULL;
+        }
+    }
+    stats->kept_words = vocab->count;
+
+    free(entries);
+    freeHeavyHitters(sketch);
+    return vocab;
+}
+
+TrainingSet* ingestTrainingData(const char *filename, int num_threads, const VocabOptions *options,
+                                StringTable **vocab_table, size_t *text_bytes, VocabStats *stats) {
+    int hash_bits = options ? options->hash_bits : 0;
+    if (hash_bits < 0 || hash_bits > MAX_FEATURE_HASH_BITS) {
+        fprintf(stderr, "Feature hashing supports 1 to %d bits.\n", MAX_FEATURE_HASH_BITS);
+        return NULL;
+    }
+
+    VocabStats local_stats;
+    if (!stats) stats = &local_stats;
+    memset(stats, 0, sizeof(VocabStats));
+
+    // A sketched vocabulary is chosen first; rows then only need looking up in it
+    StringTable *vocab = NULL;
+    int sketching = !hash_bits && options && options->sketch_words > 0;
+    if (sketching) {
+        vocab = sketchVocabulary(filename, options, stats);
+        if (!vocab) return NULL;
+    }
+    int direct = hash_bits || sketching; // Rows hold their final ids as they are parsed
+
+    num_threads = parseCSVThreads(num_threads);
+    IngestRange *ranges = (IngestRange*)calloc(num_threads, sizeof(IngestRange));
+    VocabShard *shards = (VocabShard*)calloc(num_threads, sizeof(VocabShard));
+    void *args[MAX_PARSE_THREADS];
+    TrainingSet *out = NULL;
+    int ok = ranges && shards;
+
+    // Parse, tokenize and count every range with local ids
+    for (int t = 0; ok && t < num_threads; t++) {
+        IngestRange *range = &ranges[t];
+        range->words = createStringTable(1024);
+        range->capacity = 1024;
+        range->counts = (uint64_t*)malloc(range->capacity * sizeof(uint64_t));
+        range->hashes = (uint64_t*)malloc(range->capacity * sizeof(uint64_t));
+        range->set = createTrainingSet(4096, 4096 * 16);
+        range->num_shards = num_threads;
+        range->shards = shards;
+        range->hash_bits = hash_bits;
+        range->fixed_vocab = vocab;
+        args[t] = range;
+        if (!range->words || !range->counts || !range->hashes || !range->set) ok = 0;
+    }
+    if (!ok) perror("Memory allocation failed in ingestTrainingData");
+    if (ok && parseCSVRecordsParallel(filename, num_threads, ingestRecord, args) < 0) ok = 0;
+
+    // Merge the local vocabularies by shard and sort each shard (not needed when rows are direct)
+    if (ok && !direct) {
+        runParallel(queueRangeWords, ranges, sizeof(IngestRange), num_threads);
+        for (int t = 0; t < num_threads; t++) {
+            if (!ranges[t].ok) ok = 0;
+        }
+    }
+    if (ok && !direct) {
+        for (int s = 0; s < num_threads; s++) {
+            shards[s].index = s;
+            shards[s].ranges = ranges;
+            shards[s].num_ranges = num_threads;
+        }
+        runParallel(mergeShard, shards, sizeof(VocabShard), num_threads);
+        for (int s = 0; s < num_threads; s++) {
+            if (!shards[s].ok) ok = 0;
+        }
+    }
+
+    // Final ids: a k-way merge of the sorted shards, dropping the words the cutoffs remove
+    int total_words = 0;
+    int total_rows = 0;
+    for (int s = 0; ok && !direct && s < num_threads; s++) {
+        total_words += shards[s].words->count;
+    }
+    for (int t = 0; ok && t < num_threads; t++) {
+        total_rows += ranges[t].set->num_samples;
+    }
+    if (!direct) {
+        stats->distinct_words = total_words;
+    }
+    if (ok && !direct) {
+        int expected = options && options->max_words > 0 && options->max_words < total_words ? options->max_words : total_words;
+        vocab = createStringTable(expected);
+        if (!vocab) ok = 0;
+    }
+    if (ok && !direct) {
+        int heads[MAX_PARSE_THREADS] = {0};
+        for (int n = 0; ok && n < total_words; n++) {
+            int best = -1;
+            for (int s = 0; s < num_threads; s++) {
+                if (heads[s] == shards[s].words->count) continue;
+                if (best < 0 || compareEntries(&shards[s].entries[heads[s]], &shards[best].entries[heads[best]]) < 0) best = s;
+            }
+            const VocabEntry *entry = &shards[best].entries[heads[best]++];
+            stats->total_tokens += entry->count;
+            int cutoff = pruneCutoff(entry, options, vocab->count, total_rows);
+            if (cutoff >= 0) {
+                stats->removed_words[cutoff]++;
+                stats->removed_tokens[cutoff] += entry->count;
+                stats->removed_string_bytes[cutoff] += entry->length + 1;
+                shards[best].final_ids[entry->shard_id] = PRUNED_ID;
+                continue;
+            }
+            int id = vocab->count;
+            if (stringTableIntern(vocab, entry->word, entry->length) != id) ok = 0;
+            shards[best].final_ids[entry->shard_id] = (uint32_t)id;
+        }
+        stats->kept_words = vocab->count;
+    }
+
+    // Rewrite every range's rows with the final ids, straight into one training set
+    if (ok && !direct) {
+        runParallel(remapRange, ranges, sizeof(IngestRange), num_threads);
+        for (int t = 0; t < num_threads; t++) {
+            if (!ranges[t].ok) ok = 0;
+        }
+    }
+    for (int t = 0; ok && direct && t < num_threads; t++) {
+        ranges[t].kept_nnz = ranges[t].set->nnz;
+    }
+    if (ok) {
+        int total_samples = 0;
+        size_t total_nnz = 0;
+        for (int t = 0; t < num_threads; t++) {
+            ranges[t].first_sample = total_samples;
+            ranges[t].first_nnz = total_nnz;
+            total_samples += ranges[t].set->num_samples;
+            total_nnz += ranges[t].kept_nnz;
+        }
+        out = createTrainingSet(total_samples, total_nnz);
+        if (!out) ok = 0;
+        for (int t = 0; ok && t < num_threads; t++) {
+            ranges[t].out = out;
+        }
+        if (ok) {
+            runParallel(emitRange, ranges, sizeof(IngestRange), num_threads);
+            out->num_samples = total_samples;
+            out->nnz = total_nnz;
+            *text_bytes = 0;
+            for (int t = 0; t < num_threads; t++) {
+                *text_bytes += ranges[t].text_bytes;
+            }
+        }
+    }
+
+    for (int t = 0; ranges && t < num_threads; t++) {
+        freeRange(&ranges[t]);
+    }
+    for (int s = 0; shards && s < num_threads; s++) {
+        freeStringTable(shards[s].words);
+        free(shards[s].entries);
+        free(shards[s].final_ids);
+    }
+    free(ranges);
+    free(shards);
+
+    if (!ok) {
+        freeStringTable(vocab);
+        freeTrainingSet(out);
+        return NULL;
+    }
+    *vocab_table = vocab;
+    return out;
+}
+
+void reportVocabularyPruning(const VocabStats *stats, int hidden_nodes) {
+    static const char *names[NUM_PRUNE_CUTOFFS] = { "min count", "max doc fraction", "max words" };
+    // A word costs a column of weights_ih plus its string, offset and perfect-hash slot in the model file
+    size_t column_bytes = (size_t)hidden_nodes * sizeof(float) + 2 * sizeof(uint32_t);
+
+    if (stats->sketch_words) {
+        printf("Vocabulary: chosen from a %d-word sketch (counts at most %llu too high), %d tracked, %d kept\n",
+               stats->sketch_words, (unsigned long long)stats->sketch_max_error, stats->distinct_words, stats->kept_words);
+    }
+    else {
+        printf("Vocabulary: %d distinct words, %d kept\n", stats->distinct_words, stats->kept_words);
+    }
+    printf("Cutoff            Words removed  Tokens removed  Model bytes saved\n");
+    size_t total_saved = 0;
+    for (int c = 0; c < NUM_PRUNE_CUTOFFS; c++) {
+        size_t saved = stats->removed_words[c] * column_bytes + stats->removed_string_bytes[c];
+        total_saved += saved;
+        printf("%-16s  %13d  %13.2f%%  %17.2f MB\n", names[c], stats->removed_words[c],
+               stats->total_tokens ? 100.0 * stats->removed_tokens[c] / stats->total_tokens : 0.0, saved / 1e6);
+    }
+    printf("Input dimension %d -> %d, %.2f MB smaller model\n", stats->distinct_words, stats->kept_words, total_saved / 1e6);
+}
+
+TrainingSet* ingestAppendedData(const char *filename, size_t offset, int lines_before, const VocabOptions *options,
+                                StringTable *vocab_table, size_t *text_bytes, VocabStats *stats) {
+    if (vocab_table && vocabularyIsPruned(options)) {
+        fprintf(stderr, "Appended rows can only be added to a vocabulary built without cutoffs.\n");
+        return NULL;
+    }
+    IngestRange range;
+    memset(&range, 0, sizeof(range));
+    range.words = createStringTable(1024);
+    range.capacity = 1024;
+    range.counts = (uint64_t*)malloc(range.capacity * sizeof(uint64_t));
+    range.hashes = (uint64_t*)malloc(range.capacity * sizeof(uint64_t));
+    range.set = createTrainingSet(4096, 4096 * 16);
+    range.hash_bits = vocab_table ? 0 : options->hash_bits;
+    range.fixed_vocab = vocab_table;
+    range.new_word_flag = NEW_WORD_ID;
+    if (!range.words || !range.counts || !range.hashes || !range.set) {
+        perror("Memory allocation failed in ingestAppendedData");
+        freeRange(&range);
+        return NULL;
+    }
+    if (parseCSVRecordsFrom(filename, offset, lines_before, ingestRecord, &range) < 0) {
+        freeRange(&range);
+        return NULL;
+    }
+    TrainingSet *set = range.set;
+    *text_bytes += range.text_bytes;
+    if (!vocab_table) {
+        range.set = NULL;
+        freeRange(&range);
+        return set;
+    }
+
+    // Sort the new words as a full ingestion would, on their counts in the new rows alone
+    int num_words = range.words->count;
+    VocabEntry *entries = (VocabEntry*)malloc((num_words > 0 ? num_words : 1) * sizeof(VocabEntry));
+    range.remap = (uint32_t*)malloc((num_words > 0 ? num_words : 1) * sizeof(uint32_t));
+    if (!entries || !range.remap) {
+        perror("Memory allocation failed in ingestAppendedData");
+        free(entries);
+        freeRange(&range);
+        return NULL;
+    }
+    for (size_t k = 0; k < set->nnz; k++) {
+        if (!(set->indices[k] & NEW_WORD_ID)) stats->total_tokens += (uint64_t)set->counts[k];
+    }
+    for (int id = 0; id < num_words; id++) {
+        entries[id] = (VocabEntry){ .count = range.counts[id], .word = range.words->words[id],
+                                    .length = range.words->lengths[id], .shard_id = (uint32_t)id };
+    }
+    qsort(entries, num_words, sizeof(VocabEntry), compareEntriesQsort);
+
+    // Without cutoffs every earlier word is in vocab_table, so the words not found there are new to the
+    // whole CSV and all of them get the next ids
+    int ok = 1;
+    for (int n = 0; ok && n < num_words; n++) {
+        const VocabEntry *entry = &entries[n];
+        stats->total_tokens += entry->count;
+        int id = vocab_table->count;
+        if (stringTableIntern(vocab_table, entry->word, entry->length) != id) ok = 0;
+        range.remap[entry->shard_id] = (uint32_t)id;
+    }
+    stats->distinct_words += num_words;
+    stats->kept_words = vocab_table->count;
+    free(entries);
+    if (!ok) {
+        freeRange(&range);
+        return NULL;
+    }
+
+    // Rewrite the rows in place with the final ids
+    for (size_t k = 0; k < set->nnz; k++) {
+        if (set->indices[k] & NEW_WORD_ID) set->indices[k] = range.remap[set->indices[k] & ~NEW_WORD_ID];
+    }
+    range.set = NULL;
+    freeRange(&range);
+    return set;
+}
@@ -0,0 +1,58 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stringTable.h"
+#include "../network/network.h"
+
+// Cutoffs applied while the vocabulary is built, in this order; words they remove are dropped from every row
+typedef struct {
+    uint64_t min_count;       // Drop words seen fewer times in the corpus (0 or 1 keeps all)
+    double max_doc_fraction;  // Drop words found in more than this fraction of rows (0 = no limit)
+    int max_words;            // Then keep only the most frequent words (0 = no limit)
+    int hash_bits;            // Above 0, build no vocabulary: words go to featureHashBucket() buckets and the cutoffs do not apply
+    int sketch_words;         // Above 0, choose the vocabulary in a first streaming pass that tracks only this many
+                              // words (space-saving sketch), so memory stays bounded however many distinct words
+                              // there are; counts become estimates. Use with max_words, a few times larger than it
+} VocabOptions;
+
+enum { PRUNE_MIN_COUNT, PRUNE_MAX_DOC_FRACTION, PRUNE_MAX_WORDS, NUM_PRUNE_CUTOFFS };
+
+// What each cutoff removed
+typedef struct {
+    int distinct_words;
+    int kept_words;
+    uint64_t total_tokens;
+    int removed_words[NUM_PRUNE_CUTOFFS];
+    uint64_t removed_tokens[NUM_PRUNE_CUTOFFS];
+    size_t removed_string_bytes[NUM_PRUNE_CUTOFFS];
+    int sketch_words;          // Sketch size when the vocabulary was sketched, else 0; distinct_words is then the words tracked
+    uint64_t sketch_max_error; // Most any sketched count can be too high
+} VocabStats;
+
+// Read the training CSV straight into a vocabulary and a CSR training set, on num_threads threads (0 = all cores)
+// Each thread parses, tokenizes and counts one range of the file into a local vocabulary; the local
+// vocabularies are then merged by hash shard, one shard per thread. Word ids are ordered by corpus
+// frequency, most frequent first, with ties broken by byte order, so they do not depend on the
+// number of threads. options (may be NULL) prunes the vocabulary; stats (may be NULL) receives what it removed.
+// Returns the training set and hands over the vocabulary in *vocab_table (NULL when feature hashing).
+TrainingSet* ingestTrainingData(const char *filename, int num_threads, const VocabOptions *options,
+                                StringTable **vocab_table, size_t *text_bytes, VocabStats *stats);
+
+// Whether options can leave words out of the vocabulary
+int vocabularyIsPruned(const VocabOptions *options);
+
+// Ingest only the rows from byte offset on, which were appended after an earlier ingestion of the first offset
+// bytes (lines_before lines) produced vocab_table (NULL when feature hashing) and stats
+// The vocabulary must not have been pruned (see vocabularyIsPruned()): pruning depends on counts over the
+// whole CSV, so pruned vocabularies are rebuilt in full instead. Known words keep their ids; new words get
+// the next ids, ordered by their counts in the new rows, and are added to vocab_table. stats and *text_bytes
+// are updated to cover both parts. Returns the new rows only, to be appended to the earlier set.
+TrainingSet* ingestAppendedData(const char *filename, size_t offset, int lines_before, const VocabOptions *options,
+                                StringTable *vocab_table, size_t *text_bytes, VocabStats *stats);
+
+// Print how much input dimension and model size each cutoff saved, for a network with hidden_nodes hidden nodes
+void reportVocabularyPruning(const VocabStats *stats, int hidden_nodes);
+
+#endif
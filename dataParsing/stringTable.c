@@ -0,0 +1,197 @@
+#include "stringTable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bytes per arena chunk; longer words get a chunk of their own
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+// Old slots migrated per insert while the table is growing
+// Migration finishes before the new table is half full: it takes old_size / MIGRATE_STEP
+// inserts, during which the new table (twice the old size) gains fewer entries than that
+#define MIGRATE_STEP 16
+
+uint64_t stringTableHash(const char *word, size_t length) {
+    uint64_t hash = STRING_HASH_BASIS;
+    for (size_t i = 0; i < length; i++) {
+        hash = stringHashStep(hash, (unsigned char)word[i]);
+    }
+    return hash;
+}
+
+// Finalizer from MurmurHash3; FNV's low bits alone make poor slot indices
+static inline uint64_t mixHash(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static StringSlot* allocateSlots(uint32_t count) {
+    StringSlot *slots = (StringSlot*)calloc(count, sizeof(StringSlot));
+    if (!slots) perror("Memory allocation failed for string table slots");
+    return slots;
+}
+
+StringTable* createStringTable(int expected_words) {
+    StringTable *table = (StringTable*)calloc(1, sizeof(StringTable));
+    if (!table) {
+        perror("Memory allocation failed for StringTable");
+        return NULL;
+    }
+
+    // Keep the load factor at or below one half
+    uint32_t slot_count = 16;
+    while (slot_count < 2 * (uint32_t)(expected_words > 0 ? expected_words : 1)) slot_count *= 2;
+    table->slots = allocateSlots(slot_count);
+    table->mask = slot_count - 1;
+    table->words_capacity = expected_words > 16 ? expected_words : 16;
+    table->words = (char**)malloc(table->words_capacity * sizeof(char*));
+    table->lengths = (uint32_t*)malloc(table->words_capacity * sizeof(uint32_t));
+    if (!table->slots || !table->words || !table->lengths) {
+        perror("Memory allocation failed for StringTable");
+        freeStringTable(table);
+        return NULL;
+    }
+    return table;
+}
+
+void freeStringTable(StringTable *table) {
+    if (!table) return;
+    StringArenaChunk *chunk = table->arena;
+    while (chunk) {
+        StringArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(table->slots);
+    free(table->old_slots);
+    free(table->words);
+    free(table->lengths);
+    free(table);
+}
+
+// Probe one slot array for the word; returns its id or -1
+static int probe(const StringTable *table, const StringSlot *slots, uint32_t mask, const char *word, size_t length, uint64_t mixed) {
+    uint32_t tag = (uint32_t)(mixed >> 32);
+    for (uint32_t i = (uint32_t)mixed & mask;; i = (i + 1) & mask) {
+        const StringSlot *slot = &slots[i];
+        if (slot->id == 0) return -1;
+        if (slot->tag == tag) {
+            int id = (int)slot->id - 1;
+            if (table->lengths[id] == length && memcmp(table->words[id], word, length) == 0) return id;
+        }
+    }
+}
+
+// Place an id known to be absent into a slot array
+static void place(StringSlot *slots, uint32_t mask, uint64_t mixed, uint32_t id) {
+    uint32_t i = (uint32_t)mixed & mask;
+    while (slots[i].id != 0) i = (i + 1) & mask;
+    slots[i].tag = (uint32_t)(mixed >> 32);
+    slots[i].id = id + 1;
+}
+
+int stringTableFindHashed(const StringTable *table, const char *word, size_t length, uint64_t hash) {
+    uint64_t mixed = mixHash(hash);
+    int id = probe(table, table->slots, table->mask, word, length, mixed);
+    // Migrated entries are always in the new table, so a hit in the old one is still current
+    if (id < 0 && table->old_slots) {
+        id = probe(table, table->old_slots, table->old_mask, word, length, mixed);
+    }
+    return id;
+}
+
+int stringTableFind(const StringTable *table, const char *word, size_t length) {
+    return stringTableFindHashed(table, word, length, stringTableHash(word, length));
+}
+
+// Move the next few old slots into the new table; the old array is left intact for lookups
+static void migrateSome(StringTable *table) {
+    uint32_t old_size = table->old_mask + 1;
+    for (int step = 0; step < MIGRATE_STEP && table->migrate_pos < old_size; step++, table->migrate_pos++) {
+        const StringSlot *slot = &table->old_slots[table->migrate_pos];
+        if (slot->id == 0) continue;
+        uint32_t id = slot->id - 1;
+        place(table->slots, table->mask, mixHash(stringTableHash(table->words[id], table->lengths[id])), id);
+    }
+    if (table->migrate_pos == old_size) {
+        free(table->old_slots);
+        table->old_slots = NULL;
+    }
+}
+
+// Copy a word into the arena, NUL-terminated
+static char* arenaCopy(StringTable *table, const char *word, size_t length) {
+    StringArenaChunk *chunk = table->arena;
+    if (!chunk || chunk->size - chunk->used < length + 1) {
+        size_t size = length + 1 > ARENA_CHUNK_SIZE ? length + 1 : ARENA_CHUNK_SIZE;
+        chunk = (StringArenaChunk*)malloc(sizeof(StringArenaChunk) + size);
+        if (!chunk) {
+            perror("Memory allocation failed for string arena");
+            return NULL;
+        }
+        chunk->next = table->arena;
+        chunk->used = 0;
+        chunk->size = size;
+        table->arena = chunk;
+    }
+    char *copy = chunk->data + chunk->used;
+    memcpy(copy, word, length);
+    copy[length] = '\0';
+    chunk->used += length + 1;
+    return copy;
+}
+
+int stringTableInternHashed(StringTable *table, const char *word, size_t length, uint64_t hash) {
+    int id = stringTableFindHashed(table, word, length, hash);
+    if (id >= 0) return id;
+
+    if (table->old_slots) {
+        migrateSome(table);
+    }
+    else if ((uint32_t)(table->count + 1) * 2 > table->mask + 1) {
+        // Start growing: new entries go to the doubled table, old ones follow a few at a time
+        uint32_t new_size = (table->mask + 1) * 2;
+        StringSlot *slots = allocateSlots(new_size);
+        if (!slots) return -1;
+        table->old_slots = table->slots;
+        table->old_mask = table->mask;
+        table->migrate_pos = 0;
+        table->slots = slots;
+        table->mask = new_size - 1;
+        migrateSome(table);
+    }
+
+    if (table->count == table->words_capacity) {
+        int capacity = table->words_capacity * 2;
+        char **words = (char**)realloc(table->words, capacity * sizeof(char*));
+        if (!words) {
+            perror("Memory allocation failed for string table words");
+            return -1;
+        }
+        table->words = words;
+        uint32_t *lengths = (uint32_t*)realloc(table->lengths, capacity * sizeof(uint32_t));
+        if (!lengths) {
+            perror("Memory allocation failed for string table words");
+            return -1;
+        }
+        table->lengths = lengths;
+        table->words_capacity = capacity;
+    }
+
+    char *copy = arenaCopy(table, word, length);
+    if (!copy) return -1;
+
+    id = table->count++;
+    table->words[id] = copy;
+    table->lengths[id] = (uint32_t)length;
+    place(table->slots, table->mask, mixHash(hash), (uint32_t)id);
+    return id;
+}
+
+int stringTableIntern(StringTable *table, const char *word, size_t length) {
+    return stringTableInternHashed(table, word, length, stringTableHash(word, length));
+}
@@ -0,0 +1,60 @@
+#ifndef STRINGTABLE_H
+#define STRINGTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Block of interned string bytes; words never move once stored
+typedef struct StringArenaChunk {
+    struct StringArenaChunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+} StringArenaChunk;
+
+// Slot of the open-addressing table; the hash tag is kept inline so most probes never touch the string
+typedef struct {
+    uint32_t tag; // High 32 bits of the word's hash
+    uint32_t id;  // Word id + 1; 0 marks an empty slot
+} StringSlot;
+
+// Open-addressing (linear probing) string table that interns each distinct word once
+// Words get dense ids 0, 1, 2, ... in insertion order; words[id] is NUL-terminated and
+// stays valid until the table is freed. When the table fills up it grows incrementally:
+// a larger slot array is allocated and every insert migrates a few slots from the old one,
+// so no single insert pays for rehashing the whole table.
+typedef struct {
+    StringSlot *slots;
+    uint32_t mask;           // Slot count - 1 (slot count is a power of two)
+    StringSlot *old_slots;   // Table being migrated into slots, or NULL
+    uint32_t old_mask;
+    uint32_t migrate_pos;    // Next old slot to migrate
+    int count;               // Number of distinct words
+    int words_capacity;
+    char **words;            // Interned word for each id
+    uint32_t *lengths;       // Length of each word
+    StringArenaChunk *arena; // Most recent chunk first
+} StringTable;
+
+// Hash of a word as used by the table (FNV-1a over the bytes)
+// Tokenizers can compute it while scanning with STRING_HASH_BASIS and stringHashStep()
+#define STRING_HASH_BASIS 14695981039346656037ULL
+static inline uint64_t stringHashStep(uint64_t hash, unsigned char c) {
+    return (hash ^ c) * 1099511628211ULL;
+}
+uint64_t stringTableHash(const char *word, size_t length);
+
+// Create an empty table sized for about expected_words words (it grows as needed)
+StringTable* createStringTable(int expected_words);
+void freeStringTable(StringTable *table);
+
+// Id of word[0..length), or -1 if it has not been interned
+int stringTableFind(const StringTable *table, const char *word, size_t length);
+// Same, with hash = stringTableHash(word, length) already computed
+int stringTableFindHashed(const StringTable *table, const char *word, size_t length, uint64_t hash);
+
+// Id of word[0..length), interning a copy first if it is new; returns -1 if memory runs out
+int stringTableIntern(StringTable *table, const char *word, size_t length);
+int stringTableInternHashed(StringTable *table, const char *word, size_t length, uint64_t hash);
+
+#endif
@@ -0,0 +1,149 @@
+#include "tokenizer.h"
+#include "stringTable.h"
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define TOKENIZER_VECTOR 1
+#define LANE_BITS 1             // Mask bits per byte
+#define ALL_LANES 0xFFFFull
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TOKENIZER_VECTOR 1
+#define LANE_BITS 4
+#define ALL_LANES 0xFFFFFFFFFFFFFFFFull
+#endif
+
+// Scalar classification, used for the last few bytes of the text and on other CPUs
+static const unsigned char is_delimiter[256] = {
+    [' '] = 1, ['\t'] = 1, ['\n'] = 1, ['\r'] = 1, ['.'] = 1, [','] = 1,
+    [';'] = 1, ['!'] = 1, ['?'] = 1, ['"'] = 1, ['\''] = 1
+};
+
+static inline char lowerAscii(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : c;
+}
+
+#if defined(__SSE2__)
+// LANE_BITS bits set for every delimiter among p[0..15]
+static inline uint64_t delimiterMask(const char *p) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i m = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(';')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('!')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('?')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+    return (uint64_t)_mm_movemask_epi8(m);
+}
+
+// dst[0..15] = ASCII-lowercased src[0..15]
+static inline void storeLower(char *dst, const char *src) {
+    __m128i v = _mm_loadu_si128((const __m128i*)src);
+    // Signed compares: bytes above 127 are negative and never count as upper case
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+    v = _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8('a' - 'A')));
+    _mm_storeu_si128((__m128i*)dst, v);
+}
+#elif defined(__ARM_NEON)
+static inline uint64_t delimiterMask(const char *p) {
+    uint8x16_t v = vld1q_u8((const uint8_t*)p);
+    uint8x16_t m = vceqq_u8(v, vdupq_n_u8(' '));
+    m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('\t')));
+    m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('\n')));
+    m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('\r')));
+    m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('.')));
+    m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8(',')));
+    m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8(';')));
+    m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('!')));
+    m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('?')));
+    m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('"')));
+    m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('\'')));
+    // Narrow each byte of the compare result to 4 bits (NEON has no movemask)
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+}
+
+static inline void storeLower(char *dst, const char *src) {
+    uint8x16_t v = vld1q_u8((const uint8_t*)src);
+    uint8x16_t upper = vcltq_u8(vsubq_u8(v, vdupq_n_u8('A')), vdupq_n_u8(26));
+    v = vaddq_u8(v, vandq_u8(upper, vdupq_n_u8('a' - 'A')));
+    vst1q_u8((uint8_t*)dst, v);
+}
+#endif
+
+void tokenizerInit(Tokenizer *tokenizer, const char *text, size_t length) {
+    tokenizer->text = text;
+    tokenizer->length = length;
+    tokenizer->pos = 0;
+}
+
+int nextToken(Tokenizer *tokenizer, Token *token) {
+    const char *text = tokenizer->text;
+    size_t length = tokenizer->length;
+    size_t pos = tokenizer->pos;
+
+    for (;;) {
+        // Skip delimiters
+        for (;;) {
+#ifdef TOKENIZER_VECTOR
+            if (pos + 16 <= length) {
+                uint64_t word_mask = ~delimiterMask(text + pos) & ALL_LANES;
+                if (word_mask) {
+                    pos += __builtin_ctzll(word_mask) / LANE_BITS;
+                    break;
+                }
+                pos += 16;
+                continue;
+            }
+#endif
+            if (pos >= length) {
+                tokenizer->pos = length;
+                return 0;
+            }
+            if (!is_delimiter[(unsigned char)text[pos]]) break;
+            pos++;
+        }
+
+        // Find the end of the word, lowercasing it into the buffer on the way
+        size_t start = pos;
+        for (;;) {
+            size_t n = pos - start;
+#ifdef TOKENIZER_VECTOR
+            if (pos + 16 <= length) {
+                uint64_t mask = delimiterMask(text + pos);
+                if (n <= TOKEN_MAX_LENGTH) storeLower(tokenizer->lower + n, text + pos);
+                if (mask) {
+                    pos += __builtin_ctzll(mask) / LANE_BITS;
+                    break;
+                }
+                pos += 16;
+                continue;
+            }
+#endif
+            if (pos >= length || is_delimiter[(unsigned char)text[pos]]) break;
+            if (n < TOKEN_MAX_LENGTH) tokenizer->lower[n] = lowerAscii(text[pos]);
+            pos++;
+        }
+
+        size_t n = pos - start;
+        if (n > TOKEN_MAX_LENGTH) continue; // Not a word, most likely a broken record
+
+        // Hash the lowercased word while it is still in L1
+        uint64_t hash = STRING_HASH_BASIS;
+        for (size_t i = 0; i < n; i++) {
+            hash = stringHashStep(hash, (unsigned char)tokenizer->lower[i]);
+        }
+
+        token->offset = start;
+        token->length = n;
+        token->lower = tokenizer->lower;
+        token->hash = hash;
+        tokenizer->pos = pos;
+        return 1;
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Characters that separate words
+#define TOKEN_DELIMITERS " \t\n\r.,;!?\"'"
+
+// Longest word the tokenizer yields; longer runs of non-delimiters are skipped
+#define TOKEN_MAX_LENGTH 1024
+
+// Reentrant word tokenizer over a caller-owned text, which is never copied or modified
+// Delimiters are found 16 bytes at a time (SSE2 or NEON, scalar elsewhere); each word is
+// lowercased (ASCII) into the tokenizer's own buffer while its end is searched for, then
+// hashed there, so string tables can look it up without hashing it again.
+// Keep the Tokenizer on the stack; one per thread.
+typedef struct {
+    const char *text;
+    size_t length;
+    size_t pos;
+    char lower[TOKEN_MAX_LENGTH + 16]; // Lowercased current word; 16 bytes of slack for vector stores
+} Tokenizer;
+
+// One word of the text
+typedef struct {
+    size_t offset;     // Position of the word in the text
+    size_t length;     // Length in bytes
+    const char *lower; // Lowercased word (not NUL-terminated), valid until the next nextToken() call
+    uint64_t hash;     // FNV-1a of the lowercased word, as computed by stringTableHash() and perfectHashWord()
+} Token;
+
+void tokenizerInit(Tokenizer *tokenizer, const char *text, size_t length);
+
+// Advance to the next word; returns 1 and fills token, or 0 at the end of the text
+int nextToken(Tokenizer *tokenizer, Token *token);
+
+#endif
@@ -2,18 +2,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
-#include "./dataParsing/dataParser.h"
 #include "./network/network.h"
-#include "./dataParsing/vocabHash.h"
-#include "uthash.h"
-
-// Hash table structure to map vocabulary words to their indices
-typedef struct {
-    char *word;
-    int index;
-    UT_hash_handle hh;
-} VocabIndex;
+#include "./network/kernels.h"
+#include "./dataParsing/stringTable.h"
+#include "./dataParsing/tokenizer.h"
+#include "./dataParsing/ingest.h"
+#include "./dataParsing/datasetCache.h"
 
 // Define emotion labels corresponding to their numerical indices
 const char* emotion_labels[6] = {
@@ -25,167 +19,42 @@ const char* emotion_labels[6] = {
     "Surprise"
 };
 
-// Function to convert text to numerical input (Bag of Words)
-// Convert text to numerical input using a hash table for fast lookups
-float* textToInput(const char* text, int vocab_size, VocabIndex *index_map) {
-    float* input = (float*)calloc(vocab_size, sizeof(float)); // Initialize with zeros
-    if (!input) {
-        perror("Memory allocation failed in textToInput");
-        return NULL;
-    }
-
-    // Make a copy of the text to tokenize
-    char *text_copy = strdup(text);
-    if (!text_copy) {
-        perror("Memory allocation failed for text_copy");
-        free(input);
-        return NULL;
+// Convert text to a sparse input held in the context's buffers, without allocating
+// Words are looked up in the network's perfect-hash vocabulary index, or hashed to their bucket
+// when the network uses feature hashing
+// Returns 0 if the text is longer than the context was created for
+int textToContextInput(const char* text, InferenceContext *ctx) {
+    size_t length = strlen(text);
+    if (length > (size_t)ctx->max_text_length) {
+        fprintf(stderr, "Input text longer than %d characters.\n", ctx->max_text_length);
+        return 0;
     }
 
-    // Tokenize the text based on delimiters
-    char *token = strtok(text_copy, " \t\n\r.,;!?\"'");
-    while (token != NULL) {
-        // Convert token to lowercase for case-insensitive matching
-        for (int i = 0; token[i]; i++) {
-            token[i] = tolower(token[i]);
-        }
-
-        // Use hash table lookup for O(1) access to word index
-        VocabIndex *entry;
-        HASH_FIND_STR(index_map, token, entry);
-        if (entry) {
-            input[entry->index] += 1.0f;
-        }
-
-        token = strtok(NULL, " \t\n\r.,;!?\"'");
-    }
-
-    free(text_copy);
-    return input;
-}
-
-// Function to build a vocabulary using a hash table (uthash)
-char** buildVocabulary(DataPoint* data, int num_datapoints, int *vocab_size) {
-    VocabEntry *hash_table = NULL; // Initialize the hash table
-
-    for (int i = 0; i < num_datapoints; i++) {
-        // Make a copy of the text to tokenize
-        char *text_copy = strdup(data[i].text);
-        if (!text_copy) {
-            perror("Memory allocation failed for text_copy in buildVocabulary");
-            // Free hash table
-            VocabEntry *current_entry, *tmp;
-            HASH_ITER(hh, hash_table, current_entry, tmp) {
-                HASH_DEL(hash_table, current_entry);
-                free(current_entry->word);
-                free(current_entry);
+    SparseInput *input = &ctx->input;
+    input->nnz = 0;
+    rowIndexNext(&ctx->row_index);
+
+    Tokenizer tokenizer;
+    Token token;
+    tokenizerInit(&tokenizer, text, length);
+    while (nextToken(&tokenizer, &token)) {
+        int index = ctx->nn->hash_bits ? (int)featureHashBucket(token.hash, ctx->nn->hash_bits)
+                                       : perfectHashLookupHashed(&ctx->nn->vocab_index, token.lower, token.length, token.hash);
+        if (index >= 0) {
+            int k = rowIndexFind(&ctx->row_index, input->indices, (uint32_t)index, (uint32_t)input->nnz);
+            if (k >= 0) {
+                input->counts[k] += 1.0f;
             }
-            return NULL;
-        }
-
-        // Tokenize the text based on delimiters
-        char *token = strtok(text_copy, " \t\n\r.,;!?\"'");
-        while (token != NULL) {
-            // Convert token to lowercase for case-insensitive matching
-            for (int j = 0; token[j]; j++) {
-                token[j] = tolower(token[j]);
+            else {
+                // input_capacity covers every token the text can hold, so this never overflows
+                input->indices[input->nnz] = index;
+                input->counts[input->nnz] = 1.0f;
+                input->nnz++;
             }
-
-            // Check if the word is already in the hash table
-            VocabEntry *entry;
-            HASH_FIND_STR(hash_table, token, entry);
-            if (entry == NULL) {
-                // Add new word to the hash table
-                entry = (VocabEntry*)malloc(sizeof(VocabEntry));
-                if (!entry) {
-                    perror("Memory allocation failed for VocabEntry");
-                    free(text_copy);
-                    // Free hash table
-                    VocabEntry *current_entry, *tmp;
-                    HASH_ITER(hh, hash_table, current_entry, tmp) {
-                        HASH_DEL(hash_table, current_entry);
-                        free(current_entry->word);
-                        free(current_entry);
-                    }
-                    return NULL;
-                }
-                entry->word = strdup(token);
-                if (!entry->word) {
-                    perror("Memory allocation failed for vocab word");
-                    free(entry);
-                    free(text_copy);
-                    // Free hash table
-                    VocabEntry *current_entry, *tmp;
-                    HASH_ITER(hh, hash_table, current_entry, tmp) {
-                        HASH_DEL(hash_table, current_entry);
-                        free(current_entry->word);
-                        free(current_entry);
-                    }
-                    return NULL;
-                }
-                HASH_ADD_STR(hash_table, word, entry);
-            }
-            token = strtok(NULL, " \t\n\r.,;!?\"'");
-        }
-
-        free(text_copy);
-    }
-
-    // Now, extract the vocabulary from the hash table into an array
-    *vocab_size = HASH_COUNT(hash_table);
-    char **vocab = (char**)malloc((*vocab_size) * sizeof(char*));
-    if (!vocab) {
-        perror("Memory allocation failed for vocab array");
-        // Free hash table
-        VocabEntry *current_entry, *tmp;
-        HASH_ITER(hh, hash_table, current_entry, tmp) {
-            HASH_DEL(hash_table, current_entry);
-            free(current_entry->word);
-            free(current_entry);
         }
-        return NULL;
     }
 
-    int index = 0;
-    VocabEntry *current_entry, *tmp;
-    HASH_ITER(hh, hash_table, current_entry, tmp) {
-        vocab[index++] = strdup(current_entry->word);
-        // Free hash table entries
-        HASH_DEL(hash_table, current_entry);
-        free(current_entry->word);
-        free(current_entry);
-    }
-
-    return vocab;
-}
-
-// Build a hash table that maps each vocabulary word to its index
-VocabIndex* buildIndexMap(char **vocab, int vocab_size) {
-    VocabIndex *map = NULL;
-    for (int i = 0; i < vocab_size; i++) {
-        VocabIndex *entry = (VocabIndex*)malloc(sizeof(VocabIndex));
-        if (!entry) {
-            perror("Memory allocation failed for VocabIndex");
-            VocabIndex *cur, *tmp;
-            HASH_ITER(hh, map, cur, tmp) {
-                HASH_DEL(map, cur);
-                free(cur);
-            }
-            return NULL;
-        }
-        entry->word = vocab[i];
-        entry->index = i;
-        HASH_ADD_KEYPTR(hh, map, entry->word, strlen(entry->word), entry);
-    }
-    return map;
-}
-
-void freeIndexMap(VocabIndex *map) {
-    VocabIndex *cur, *tmp;
-    HASH_ITER(hh, map, cur, tmp) {
-        HASH_DEL(map, cur);
-        free(cur);
-    }
+    return 1;
 }
 
 int main() {
@@ -193,9 +62,13 @@ int main() {
     NeuralNetwork* nn = NULL;
     char **vocab = NULL;
     int vocab_size = 0;
-    VocabIndex *index_map = NULL;
+    StringTable *vocab_table = NULL; // Owns the vocabulary words when training a new model
     const char* model_filename = "model.bin"; // Binary model file
 
+    // Select the vectorized kernels for this CPU once, before any network code runs
+    initKernels();
+    printf("Using %s kernels.\n", kernels->name);
+
     printf("=== Emotion Classifier ===\n");
     printf("1. Load existing model\n");
     printf("2. Train a new model\n");
@@ -213,141 +86,111 @@ int main() {
             fprintf(stderr, "Failed to load the model. Exiting.\n");
             return 1;
         }
-        index_map = buildIndexMap(vocab, vocab_size);
-        if (!index_map) {
-            fprintf(stderr, "Failed to build vocabulary index.\n");
-            for (int i = 0; i < vocab_size; i++) free(vocab[i]);
-            free(vocab);
-            freeNetwork(nn);
-            return 1;
-        }
-        printf("Model loaded successfully from '%s'.\n", model_filename);
+        printf("Model loaded successfully from '%s' (hidden activation: %s).\n", model_filename, activationName(nn->hidden_activation));
     }
     else if (choice == 2) {
         // Train a new model
-        int num_datapoints;
-        DataPoint* data = parseCSV("emotions.csv", &num_datapoints);
-
-        if (!data) {
-            fprintf(stderr, "Error parsing CSV file.\n");
+        // Parse, tokenize and featurize the CSV in a single pass, building the vocabulary on the way,
+        // or map the result of an earlier run from the cache
+        const char *training_filename = "emotions.csv"; // May also be gzip or zstd compressed, e.g. "emotions.csv.gz"
+        int ingest_threads = 0;      // Threads for reading the CSV and building the vocabulary; 0 uses every core
+        const char *cache_filename = NULL; // E.g. "emotions.cache" keeps a pre-tokenized copy reused while the CSV and options are unchanged
+        VocabOptions vocab_options = {
+            .min_count = 0,          // E.g. 2 drops words seen only once (mostly typos); 0 keeps them
+            .max_doc_fraction = 0.0, // E.g. 0.5 drops words found in over half the rows; 0 keeps them
+            .max_words = 0,          // E.g. 10000 keeps the 10,000 most frequent words; 0 keeps them all
+            .hash_bits = 0,          // E.g. 14 hashes words into 16384 inputs instead of building a vocabulary
+            .sketch_words = 0        // E.g. 100000 picks the top max_words in one pass with fixed memory
+        };
+        int report_pruning = 1;      // Print what each vocabulary cutoff saved
+        size_t text_bytes = 0;
+        VocabStats vocab_stats;
+        TrainingSet *training_set = ingestTrainingDataCached(training_filename, cache_filename, ingest_threads, &vocab_options,
+                                                             &vocab_table, &text_bytes, &vocab_stats);
+        if (!training_set) {
+            fprintf(stderr, "Error reading the training data.\n");
             return 1;
         }
-
-        printf("Total valid data points: %d\n", num_datapoints);
-
-        // Build vocabulary using hash table
-        vocab = buildVocabulary(data, num_datapoints, &vocab_size);
-        if (!vocab) {
-            fprintf(stderr, "Failed to build vocabulary.\n");
-            freeData(data, num_datapoints);
-            return 1;
+        int num_datapoints = training_set->num_samples;
+        printf("Total valid data points: %d (%.2f MB of text)\n", num_datapoints, text_bytes / 1e6);
+
+        // Determine input size (size of vocabulary, or number of hash buckets)
+        int input_size;
+        if (vocab_table) {
+            vocab = vocab_table->words;
+            vocab_size = vocab_table->count;
+            input_size = vocab_size;
+            printf("Vocabulary size: %d\n", vocab_size);
         }
-
-        printf("Vocabulary size: %d\n", vocab_size);
-
-        index_map = buildIndexMap(vocab, vocab_size);
-        if (!index_map) {
-            fprintf(stderr, "Failed to build vocabulary index.\n");
-            for (int j = 0; j < vocab_size; j++) {
-                free(vocab[j]);
-            }
-            free(vocab);
-            freeData(data, num_datapoints);
-            return 1;
-        }
-
-        // Determine input size (size of vocabulary)
-        int input_size = vocab_size;
-
-        // Allocate memory for inputs and targets
-        float** inputs = (float**)malloc(num_datapoints * sizeof(float*));
-        float** targets = (float**)malloc(num_datapoints * sizeof(float*));
-
-        if (!inputs || !targets) {
-            fprintf(stderr, "Memory allocation failed for inputs or targets.\n");
-            // Free allocated memory
-            if (inputs) free(inputs);
-            if (targets) free(targets);
-            for (int i = 0; i < vocab_size; i++) {
-                free(vocab[i]);
-            }
-            free(vocab);
-            freeData(data, num_datapoints);
-            return 1;
-        }
-
-        // Convert text data to numerical input and create target arrays
-        for (int i = 0; i < num_datapoints; i++) {
-            inputs[i] = textToInput(data[i].text, vocab_size, index_map);
-            if (!inputs[i]) {
-                fprintf(stderr, "Failed to convert text to input for data point %d.\n", i);
-                // Free previously allocated inputs and targets
-                for (int j = 0; j < i; j++) {
-                    free(inputs[j]);
-                    free(targets[j]);
-                }
-                free(inputs);
-                free(targets);
-                for (int j = 0; j < vocab_size; j++) {
-                    free(vocab[j]);
-                }
-                free(vocab);
-                freeData(data, num_datapoints);
-                return 1;
-            }
-
-            targets[i] = (float*)calloc(6, sizeof(float)); // 6 output nodes for 6 emotions
-            if (!targets[i]) {
-                fprintf(stderr, "Memory allocation failed for target of data point %d.\n", i);
-                // Free previously allocated inputs and targets
-                for (int j = 0; j <= i; j++) {
-                    free(inputs[j]);
-                    if (j < i) free(targets[j]);
-                }
-                free(inputs);
-                free(targets);
-                for (int j = 0; j < vocab_size; j++) {
-                    free(vocab[j]);
-                }
-                free(vocab);
-                freeData(data, num_datapoints);
-                return 1;
-            }
-
-            // One-hot encoding for targets
-            targets[i][data[i].label] = 1.0f;
+        else {
+            input_size = 1 << vocab_options.hash_bits;
+            printf("Feature hashing into %d buckets, no vocabulary\n", input_size);
         }
 
-        // Free the raw data as it's no longer needed
-        freeData(data, num_datapoints);
+        size_t set_bytes = (training_set->num_samples + 1) * sizeof(size_t) + training_set->num_samples * sizeof(uint8_t)
+                           + training_set->nnz * (sizeof(uint32_t) + sizeof(float));
+        printf("Training set: %d samples, %zu distinct tokens, %.2f MB\n", training_set->num_samples, training_set->nnz, set_bytes / 1e6);
 
         // 2. Create and Train the Network
         int hidden_nodes = 10;       // Example: Adjust as needed
         float learning_rate = 0.1f; // Example: Adjust as needed
         int epochs = 100;            // Example: Adjust as needed
-
-        nn = createNetwork(input_size, hidden_nodes, 6); // 6 output nodes for 6 emotions
+        int batch_size = 1;          // Samples per update; scale learning_rate up with it (e.g. 32 -> 2.0f)
+        int num_threads = 1;         // Above 1, trains in parallel using the mode below
+        TrainMode mode = TRAIN_HOGWILD; // Lock-free shards; TRAIN_SYNC gives bit-identical weights for any num_threads
+        int report_scaling = 0;      // Set to 1 to print Hogwild throughput for 1..num_threads threads first
+        int report_index_order = 0;  // Set to 1 to compare the frequency-ordered word ids with shuffled ones first
+        int use_huge_pages = 0;      // Set to 1 to back the weights with huge pages for large vocabularies
+        Activation hidden_activation = ACT_SIGMOID; // Also ACT_SIGMOID_FAST, ACT_SIGMOID_LUT, ACT_TANH, ACT_RELU
+        Activation output_activation = ACT_SIGMOID; // Keep a sigmoid variant here so outputs stay in [0, 1]
+
+        nn = createNetworkWithOptions(input_size, hidden_nodes, 6, use_huge_pages); // 6 output nodes for 6 emotions
         if (!nn) {
             fprintf(stderr, "Failed to create neural network.\n");
-            // Free inputs, targets, vocab
-            for (int i = 0; i < num_datapoints; i++) {
-                free(inputs[i]);
-                free(targets[i]);
-            }
-            free(inputs);
-            free(targets);
-            for (int j = 0; j < vocab_size; j++) {
-                free(vocab[j]);
-            }
-            free(vocab);
+            freeTrainingSet(training_set);
+            freeStringTable(vocab_table);
             return 1;
         }
+        nn->hidden_activation = hidden_activation;
+        nn->output_activation = output_activation;
+        nn->hash_bits = vocab_options.hash_bits;
+        if (report_pruning && vocab_table) {
+            reportVocabularyPruning(&vocab_stats, hidden_nodes);
+        }
 
         printf("Training the neural network...\n");
-        // Train the network
-        train(nn, inputs, targets, num_datapoints, learning_rate, epochs);
+        // Train the network on the sparse inputs so cost scales with tokens per sample, not vocabulary size
+        TrainOptions options = { .learning_rate = learning_rate, .epochs = epochs, .batch_size = batch_size, .num_threads = num_threads, .mode = mode };
+        if (report_scaling) {
+            reportHogwildScaling(nn, training_set, &options, num_threads);
+        }
+        if (report_index_order) {
+            reportIndexOrderGain(nn, training_set, &options);
+        }
+        trainSparse(nn, training_set, &options);
         printf("Training completed.\n");
 
+        // Score the training set with batched inference, one tile of row views at a time
+        int correct = 0;
+        for (int first = 0; first < training_set->num_samples; first += PREDICT_TILE) {
+            SparseInput rows[PREDICT_TILE];
+            float outputs[PREDICT_TILE * 6];
+            int count = training_set->num_samples - first < PREDICT_TILE ? training_set->num_samples - first : PREDICT_TILE;
+            for (int b = 0; b < count; b++) {
+                rows[b] = trainingSetRow(training_set, first + b);
+            }
+            if (!predictBatchSparse(nn, rows, count, outputs)) break;
+            for (int b = 0; b < count; b++) {
+                const float *row = outputs + (size_t)b * 6;
+                int best = 0;
+                for (int j = 1; j < 6; j++) {
+                    if (row[j] > row[best]) best = j;
+                }
+                if (best == training_set->labels[first + b]) correct++;
+            }
+        }
+        printf("Training accuracy: %.2f%%\n", 100.0 * correct / training_set->num_samples);
+
         // Save the model in binary format
         if (saveNetworkBinary(nn, vocab, vocab_size, model_filename)) {
             printf("Model saved successfully to '%s'.\n", model_filename);
@@ -357,21 +200,34 @@ int main() {
         }
 
         // Free training data
-        for (int i = 0; i < num_datapoints; i++) {
-            free(inputs[i]);
-            free(targets[i]);
+        freeTrainingSet(training_set);
+
+        // Classify with the same perfect-hash index a loaded model uses
+        if (!nn->hash_bits && !buildPerfectHash(&nn->vocab_index, vocab, vocab_size)) {
+            fprintf(stderr, "Failed to build vocabulary index.\n");
+            freeStringTable(vocab_table);
+            freeNetwork(nn);
+            return 1;
         }
-        free(inputs);
-        free(targets);
     }
     else {
         fprintf(stderr, "Invalid choice. Exiting.\n");
         return 1;
     }
 
+    // Scratch buffers for the interactive loop, so classifying a query does no heap allocation
+    char input_text[1024]; // Increased buffer size to handle longer inputs
+    InferenceContext *ctx = createInferenceContext(nn, sizeof(input_text) - 1);
+    if (!ctx) {
+        fprintf(stderr, "Failed to create the inference context.\n");
+        if (vocab_table) freeStringTable(vocab_table);
+        else freeVocabulary(nn, vocab, vocab_size);
+        freeNetwork(nn);
+        return 1;
+    }
+
     // Interactive Classification Loop
     while (1) {
-        char input_text[1024]; // Increased buffer size to handle longer inputs
         printf("\nEnter text to classify (or type 'exit' to quit):\n> ");
         if (!fgets(input_text, sizeof(input_text), stdin)) {
             fprintf(stderr, "Error reading input. Exiting.\n");
@@ -388,19 +244,13 @@ int main() {
         }
 
         // Convert input text to numerical input
-        float* numerical_input = textToInput(input_text, vocab_size, index_map);
-        if (!numerical_input) {
+        if (!textToContextInput(input_text, ctx)) {
             fprintf(stderr, "Failed to convert input text to numerical format.\n");
             continue;
         }
 
         // Predict
-        float *prediction = predict(nn, numerical_input);
-        if (!prediction) {
-            fprintf(stderr, "Prediction failed.\n");
-            free(numerical_input);
-            continue;
-        }
+        const float *prediction = inferSparse(ctx, &ctx->input);
 
         // Display the results with emotion names
         printf("Prediction:\n");
@@ -418,18 +268,12 @@ int main() {
             }
         }
         printf("Predicted Emotion: %s\n", emotion_labels[predicted_emotion]);
-
-        // Free allocated memory
-        free(numerical_input);
-        free(prediction);
     }
+    freeInferenceContext(ctx);
 
     // Free allocated memory for vocabulary
-    freeIndexMap(index_map);
-    for (int i = 0; i < vocab_size; i++) {
-        free(vocab[i]);
-    }
-    free(vocab);
+    if (vocab_table) freeStringTable(vocab_table);
+    else freeVocabulary(nn, vocab, vocab_size);
 
     // Free neural network resources
     freeNetwork(nn);
@@ -0,0 +1,88 @@
+#include "activation.h"
+#include "kernels.h"
+#include <math.h>
+#include <pthread.h>
+
+// Lookup table covering [-SIGMOID_LUT_RANGE, SIGMOID_LUT_RANGE]; beyond that the sigmoid is 0 or 1 to within 1.2e-7,
+// so the end entries are used as-is
+#define SIGMOID_LUT_SIZE 8192
+#define SIGMOID_LUT_RANGE 16.0f
+
+static float sigmoid_lut[SIGMOID_LUT_SIZE + 1];
+static pthread_once_t sigmoid_lut_once = PTHREAD_ONCE_INIT;
+
+static void buildSigmoidLut(void) {
+    for (int i = 0; i <= SIGMOID_LUT_SIZE; i++) {
+        float x = -SIGMOID_LUT_RANGE + 2.0f * SIGMOID_LUT_RANGE * i / SIGMOID_LUT_SIZE;
+        sigmoid_lut[i] = 1.0f / (1.0f + expf(-x));
+    }
+}
+
+static void sigmoidExact(float *x, int n) {
+    for (int i = 0; i < n; i++) {
+        x[i] = 1.0f / (1.0f + expf(-x[i]));
+    }
+}
+
+static void sigmoidLut(float *x, int n) {
+    pthread_once(&sigmoid_lut_once, buildSigmoidLut);
+
+    const float scale = SIGMOID_LUT_SIZE / (2.0f * SIGMOID_LUT_RANGE);
+    for (int i = 0; i < n; i++) {
+        // Position in table units, clamped so that index + 1 stays inside the table
+        float position = (x[i] + SIGMOID_LUT_RANGE) * scale;
+        position = position < 0.0f ? 0.0f : (position > SIGMOID_LUT_SIZE - 1 ? SIGMOID_LUT_SIZE - 1 : position);
+        int index = (int)position;
+        float fraction = position - index;
+        x[i] = sigmoid_lut[index] + fraction * (sigmoid_lut[index + 1] - sigmoid_lut[index]);
+    }
+}
+
+static void tanhExact(float *x, int n) {
+    for (int i = 0; i < n; i++) {
+        x[i] = tanhf(x[i]);
+    }
+}
+
+void activate(Activation act, float *x, int n) {
+    switch (act) {
+        case ACT_SIGMOID_FAST: kernels->sigmoidFast(x, n); break;
+        case ACT_SIGMOID_LUT:  sigmoidLut(x, n); break;
+        case ACT_TANH:         tanhExact(x, n); break;
+        case ACT_RELU:         kernels->relu(x, n); break;
+        case ACT_SIGMOID:
+        default:               sigmoidExact(x, n); break;
+    }
+}
+
+void activationGradient(Activation act, const float *y, float *gradients, int n) {
+    switch (act) {
+        case ACT_TANH:
+            for (int i = 0; i < n; i++) {
+                gradients[i] *= 1.0f - y[i] * y[i];
+            }
+            break;
+        case ACT_RELU:
+            for (int i = 0; i < n; i++) {
+                gradients[i] = y[i] > 0.0f ? gradients[i] : 0.0f;
+            }
+            break;
+        default:
+            // All sigmoid variants share the derivative y * (1 - y)
+            for (int i = 0; i < n; i++) {
+                gradients[i] *= y[i] * (1.0f - y[i]);
+            }
+            break;
+    }
+}
+
+const char* activationName(Activation act) {
+    switch (act) {
+        case ACT_SIGMOID:      return "sigmoid";
+        case ACT_SIGMOID_FAST: return "sigmoid (rational approximation)";
+        case ACT_SIGMOID_LUT:  return "sigmoid (lookup table)";
+        case ACT_TANH:         return "tanh";
+        case ACT_RELU:         return "relu";
+        default:               return "unknown";
+    }
+}
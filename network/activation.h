@@ -0,0 +1,24 @@
+#ifndef ACTIVATION_H
+#define ACTIVATION_H
+
+// Activation functions selectable per layer
+// The values are stored in the model file, so existing entries must keep their numbers
+typedef enum {
+    ACT_SIGMOID = 0,      // Exact logistic sigmoid using expf
+    ACT_SIGMOID_FAST = 1, // Vectorized rational approximation of the sigmoid (error below 1e-4)
+    ACT_SIGMOID_LUT = 2,  // Sigmoid from a lookup table with linear interpolation (error below 1e-6)
+    ACT_TANH = 3,         // Hyperbolic tangent
+    ACT_RELU = 4,         // Rectified linear unit
+    ACT_COUNT
+} Activation;
+
+// Apply the activation in place to n values
+void activate(Activation act, float *x, int n);
+
+// Multiply each gradient by the activation's derivative, given the activation's outputs y
+void activationGradient(Activation act, const float *y, float *gradients, int n);
+
+// Human-readable name, e.g. for log output
+const char* activationName(Activation act);
+
+#endif
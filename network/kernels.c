@@ -0,0 +1,473 @@
+#include "kernels.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_X86 1
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define KERNELS_NEON 1
+#endif
+
+// ----- Scalar reference -----
+
+static float dotScalar(const float *a, const float *b, int n) {
+    float sum = 0.0f;
+    for (int i = 0; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static float sparseDotScalar(const float *row, const uint32_t *indices, const float *values, int nnz) {
+    float sum = 0.0f;
+    for (int k = 0; k < nnz; k++) {
+        sum += row[indices[k]] * values[k];
+    }
+    return sum;
+}
+
+static void axpyScalar(float *y, float a, const float *x, int n) {
+    for (int i = 0; i < n; i++) {
+        y[i] += a * x[i];
+    }
+}
+
+static void addScalar(float *y, const float *x, int n) {
+    for (int i = 0; i < n; i++) {
+        y[i] += x[i];
+    }
+}
+
+// sigmoid(x) = 0.5 + 0.5 * tanh(x / 2), with tanh from its [7/6] Pade approximant
+// The approximant passes +-1 around |x| = 5, so the argument is clamped there and the result clamped to [-1, 1]
+#define TANH_CLAMP 4.97f
+
+static void sigmoidFastScalar(float *x, int n) {
+    for (int i = 0; i < n; i++) {
+        float t = 0.5f * x[i];
+        t = t > TANH_CLAMP ? TANH_CLAMP : (t < -TANH_CLAMP ? -TANH_CLAMP : t);
+        float t2 = t * t;
+        float p = t * (135135.0f + t2 * (17325.0f + t2 * (378.0f + t2)));
+        float q = 135135.0f + t2 * (62370.0f + t2 * (3150.0f + t2 * 28.0f));
+        float tanh_t = p / q;
+        tanh_t = tanh_t > 1.0f ? 1.0f : (tanh_t < -1.0f ? -1.0f : tanh_t);
+        x[i] = 0.5f + 0.5f * tanh_t;
+    }
+}
+
+static void reluScalar(float *x, int n) {
+    for (int i = 0; i < n; i++) {
+        x[i] = x[i] > 0.0f ? x[i] : 0.0f;
+    }
+}
+
+static const KernelSet scalar_kernels = {
+    "scalar", dotScalar, sparseDotScalar, axpyScalar, addScalar, sigmoidFastScalar, reluScalar
+};
+
+#ifdef KERNELS_X86
+
+// ----- AVX2 + FMA -----
+
+__attribute__((target("avx2,fma")))
+static float horizontalSumAvx2(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+__attribute__((target("avx2,fma")))
+static float dotAvx2(const float *a, const float *b, int n) {
+    // Two accumulators hide the FMA latency
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    float sum = horizontalSumAvx2(_mm256_add_ps(acc0, acc1));
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static float sparseDotAvx2(const float *row, const uint32_t *indices, const float *values, int nnz) {
+    __m256 acc = _mm256_setzero_ps();
+    int k = 0;
+    for (; k + 8 <= nnz; k += 8) {
+        __m256i index = _mm256_loadu_si256((const __m256i*)(indices + k));
+        __m256 weights = _mm256_i32gather_ps(row, index, sizeof(float));
+        acc = _mm256_fmadd_ps(weights, _mm256_loadu_ps(values + k), acc);
+    }
+    float sum = horizontalSumAvx2(acc);
+    for (; k < nnz; k++) {
+        sum += row[indices[k]] * values[k];
+    }
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static void axpyAvx2(float *y, float a, const float *x, int n) {
+    __m256 scale = _mm256_set1_ps(a);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(scale, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+    }
+    for (; i < n; i++) {
+        y[i] += a * x[i];
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void addAvx2(float *y, const float *x, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_loadu_ps(x + i)));
+    }
+    for (; i < n; i++) {
+        y[i] += x[i];
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void sigmoidFastAvx2(float *x, int n) {
+    const __m256 clamp = _mm256_set1_ps(TANH_CLAMP);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 t = _mm256_mul_ps(half, _mm256_loadu_ps(x + i));
+        t = _mm256_max_ps(_mm256_min_ps(t, clamp), _mm256_sub_ps(_mm256_setzero_ps(), clamp));
+        __m256 t2 = _mm256_mul_ps(t, t);
+        __m256 p = _mm256_add_ps(_mm256_set1_ps(378.0f), t2);
+        p = _mm256_fmadd_ps(p, t2, _mm256_set1_ps(17325.0f));
+        p = _mm256_fmadd_ps(p, t2, _mm256_set1_ps(135135.0f));
+        p = _mm256_mul_ps(p, t);
+        __m256 q = _mm256_fmadd_ps(_mm256_set1_ps(28.0f), t2, _mm256_set1_ps(3150.0f));
+        q = _mm256_fmadd_ps(q, t2, _mm256_set1_ps(62370.0f));
+        q = _mm256_fmadd_ps(q, t2, _mm256_set1_ps(135135.0f));
+        __m256 tanh_t = _mm256_div_ps(p, q);
+        tanh_t = _mm256_max_ps(_mm256_min_ps(tanh_t, one), _mm256_sub_ps(_mm256_setzero_ps(), one));
+        _mm256_storeu_ps(x + i, _mm256_fmadd_ps(half, tanh_t, half));
+    }
+    sigmoidFastScalar(x + i, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void reluAvx2(float *x, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(x + i, _mm256_max_ps(_mm256_loadu_ps(x + i), _mm256_setzero_ps()));
+    }
+    reluScalar(x + i, n - i);
+}
+
+static const KernelSet avx2_kernels = {
+    "avx2", dotAvx2, sparseDotAvx2, axpyAvx2, addAvx2, sigmoidFastAvx2, reluAvx2
+};
+
+// ----- AVX-512F -----
+// Tails are handled with masked loads instead of scalar loops
+
+__attribute__((target("avx512f")))
+static float dotAvx512(const float *a, const float *b, int n) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    }
+    if (i < n) {
+        __mmask16 mask = (__mmask16)((1u << (n - i)) - 1);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+__attribute__((target("avx512f")))
+static float sparseDotAvx512(const float *row, const uint32_t *indices, const float *values, int nnz) {
+    __m512 acc = _mm512_setzero_ps();
+    int k = 0;
+    for (; k + 16 <= nnz; k += 16) {
+        __m512i index = _mm512_loadu_si512((const void*)(indices + k));
+        __m512 weights = _mm512_i32gather_ps(index, row, sizeof(float));
+        acc = _mm512_fmadd_ps(weights, _mm512_loadu_ps(values + k), acc);
+    }
+    if (k < nnz) {
+        __mmask16 mask = (__mmask16)((1u << (nnz - k)) - 1);
+        __m512i index = _mm512_maskz_loadu_epi32(mask, indices + k);
+        __m512 weights = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, index, row, sizeof(float));
+        acc = _mm512_fmadd_ps(weights, _mm512_maskz_loadu_ps(mask, values + k), acc);
+    }
+    return _mm512_reduce_add_ps(acc);
+}
+
+__attribute__((target("avx512f")))
+static void axpyAvx512(float *y, float a, const float *x, int n) {
+    __m512 scale = _mm512_set1_ps(a);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(y + i, _mm512_fmadd_ps(scale, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+    }
+    if (i < n) {
+        __mmask16 mask = (__mmask16)((1u << (n - i)) - 1);
+        __m512 result = _mm512_fmadd_ps(scale, _mm512_maskz_loadu_ps(mask, x + i), _mm512_maskz_loadu_ps(mask, y + i));
+        _mm512_mask_storeu_ps(y + i, mask, result);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void addAvx512(float *y, const float *x, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(y + i, _mm512_add_ps(_mm512_loadu_ps(y + i), _mm512_loadu_ps(x + i)));
+    }
+    if (i < n) {
+        __mmask16 mask = (__mmask16)((1u << (n - i)) - 1);
+        __m512 result = _mm512_add_ps(_mm512_maskz_loadu_ps(mask, y + i), _mm512_maskz_loadu_ps(mask, x + i));
+        _mm512_mask_storeu_ps(y + i, mask, result);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void sigmoidFastAvx512(float *x, int n) {
+    const __m512 clamp = _mm512_set1_ps(TANH_CLAMP);
+    const __m512 neg_clamp = _mm512_set1_ps(-TANH_CLAMP);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 neg_one = _mm512_set1_ps(-1.0f);
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 mask = n - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+        __m512 t = _mm512_mul_ps(half, _mm512_maskz_loadu_ps(mask, x + i));
+        t = _mm512_max_ps(_mm512_min_ps(t, clamp), neg_clamp);
+        __m512 t2 = _mm512_mul_ps(t, t);
+        __m512 p = _mm512_add_ps(_mm512_set1_ps(378.0f), t2);
+        p = _mm512_fmadd_ps(p, t2, _mm512_set1_ps(17325.0f));
+        p = _mm512_fmadd_ps(p, t2, _mm512_set1_ps(135135.0f));
+        p = _mm512_mul_ps(p, t);
+        __m512 q = _mm512_fmadd_ps(_mm512_set1_ps(28.0f), t2, _mm512_set1_ps(3150.0f));
+        q = _mm512_fmadd_ps(q, t2, _mm512_set1_ps(62370.0f));
+        q = _mm512_fmadd_ps(q, t2, _mm512_set1_ps(135135.0f));
+        __m512 tanh_t = _mm512_max_ps(_mm512_min_ps(_mm512_div_ps(p, q), one), neg_one);
+        _mm512_mask_storeu_ps(x + i, mask, _mm512_fmadd_ps(half, tanh_t, half));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void reluAvx512(float *x, int n) {
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 mask = n - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+        _mm512_mask_storeu_ps(x + i, mask, _mm512_max_ps(_mm512_maskz_loadu_ps(mask, x + i), _mm512_setzero_ps()));
+    }
+}
+
+static const KernelSet avx512_kernels = {
+    "avx512", dotAvx512, sparseDotAvx512, axpyAvx512, addAvx512, sigmoidFastAvx512, reluAvx512
+};
+
+#endif // KERNELS_X86
+
+#ifdef KERNELS_NEON
+
+// ----- NEON (always available on AArch64) -----
+
+static float dotNeon(const float *a, const float *b, int n) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static void axpyNeon(float *y, float a, const float *x, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(y + i, vfmaq_n_f32(vld1q_f32(y + i), vld1q_f32(x + i), a));
+    }
+    for (; i < n; i++) {
+        y[i] += a * x[i];
+    }
+}
+
+static void addNeon(float *y, const float *x, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(y + i, vaddq_f32(vld1q_f32(y + i), vld1q_f32(x + i)));
+    }
+    for (; i < n; i++) {
+        y[i] += x[i];
+    }
+}
+
+static void sigmoidFastNeon(float *x, int n) {
+    const float32x4_t clamp = vdupq_n_f32(TANH_CLAMP);
+    const float32x4_t neg_clamp = vdupq_n_f32(-TANH_CLAMP);
+    const float32x4_t half = vdupq_n_f32(0.5f);
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t neg_one = vdupq_n_f32(-1.0f);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t t = vmulq_f32(half, vld1q_f32(x + i));
+        t = vmaxq_f32(vminq_f32(t, clamp), neg_clamp);
+        float32x4_t t2 = vmulq_f32(t, t);
+        float32x4_t p = vaddq_f32(vdupq_n_f32(378.0f), t2);
+        p = vfmaq_f32(vdupq_n_f32(17325.0f), p, t2);
+        p = vfmaq_f32(vdupq_n_f32(135135.0f), p, t2);
+        p = vmulq_f32(p, t);
+        float32x4_t q = vfmaq_f32(vdupq_n_f32(3150.0f), vdupq_n_f32(28.0f), t2);
+        q = vfmaq_f32(vdupq_n_f32(62370.0f), q, t2);
+        q = vfmaq_f32(vdupq_n_f32(135135.0f), q, t2);
+        float32x4_t tanh_t = vmaxq_f32(vminq_f32(vdivq_f32(p, q), one), neg_one);
+        vst1q_f32(x + i, vfmaq_f32(half, half, tanh_t));
+    }
+    sigmoidFastScalar(x + i, n - i);
+}
+
+static void reluNeon(float *x, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(x + i, vmaxq_f32(vld1q_f32(x + i), vdupq_n_f32(0.0f)));
+    }
+    reluScalar(x + i, n - i);
+}
+
+// NEON has no gather, so the sparse dot product stays scalar
+static const KernelSet neon_kernels = {
+    "neon", dotNeon, sparseDotScalar, axpyNeon, addNeon, sigmoidFastNeon, reluNeon
+};
+
+#endif // KERNELS_NEON
+
+const KernelSet *kernels = &scalar_kernels;
+
+// ----- Self-test -----
+
+// Small deterministic generator so the self-test does not disturb rand()
+static float testValue(uint32_t *state) {
+    *state = *state * 1664525u + 1013904223u;
+    return (float)(*state >> 8) / (float)(1u << 24) * 2.0f - 1.0f;
+}
+
+#define SELFTEST_MAX_N 1031
+
+int kernelSelfTest(const KernelSet *set) {
+    // Lengths cover empty input, every tail length around the vector widths, and long runs
+    static const int lengths[] = { 0, 1, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 100, 1031 };
+    float a[SELFTEST_MAX_N], b[SELFTEST_MAX_N], y_ref[SELFTEST_MAX_N], y_test[SELFTEST_MAX_N];
+    uint32_t indices[SELFTEST_MAX_N];
+    uint32_t state = 12345u;
+
+    for (size_t t = 0; t < sizeof(lengths) / sizeof(lengths[0]); t++) {
+        int n = lengths[t];
+        float magnitude = 0.0f;
+        for (int i = 0; i < n; i++) {
+            a[i] = testValue(&state);
+            b[i] = testValue(&state);
+            y_ref[i] = y_test[i] = testValue(&state);
+            // Gather only from the n entries of a filled for this length
+            indices[i] = (uint32_t)((testValue(&state) + 1.0f) * 0.5f * (n - 1));
+            magnitude += fabsf(a[i] * b[i]);
+        }
+
+        // Vector kernels reassociate the sums, so compare against a tolerance scaled by the summed magnitudes
+        float tolerance = 1e-5f * magnitude + 1e-6f;
+        if (fabsf(set->dot(a, b, n) - dotScalar(a, b, n)) > tolerance) {
+            fprintf(stderr, "Kernel self-test: %s dot failed for n = %d.\n", set->name, n);
+            return 0;
+        }
+
+        float gathered = 0.0f;
+        for (int k = 0; k < n; k++) {
+            gathered += fabsf(a[indices[k]] * b[k]);
+        }
+        if (fabsf(set->sparseDot(a, indices, b, n) - sparseDotScalar(a, indices, b, n)) > 1e-5f * gathered + 1e-6f) {
+            fprintf(stderr, "Kernel self-test: %s sparseDot failed for n = %d.\n", set->name, n);
+            return 0;
+        }
+
+        // The fast sigmoid must also stay within its documented error of the exact function
+        float activations[SELFTEST_MAX_N], rectified[SELFTEST_MAX_N];
+        for (int i = 0; i < n; i++) {
+            activations[i] = rectified[i] = 12.0f * a[i];
+        }
+        set->sigmoidFast(activations, n);
+        set->relu(rectified, n);
+        for (int i = 0; i < n; i++) {
+            float x = 12.0f * a[i];
+            if (fabsf(activations[i] - 1.0f / (1.0f + expf(-x))) > 1e-4f || rectified[i] != (x > 0.0f ? x : 0.0f)) {
+                fprintf(stderr, "Kernel self-test: %s activation failed for n = %d.\n", set->name, n);
+                return 0;
+            }
+        }
+
+        set->axpy(y_test, 0.5f, a, n);
+        axpyScalar(y_ref, 0.5f, a, n);
+        set->add(y_test, b, n);
+        addScalar(y_ref, b, n);
+        for (int i = 0; i < n; i++) {
+            if (fabsf(y_test[i] - y_ref[i]) > 1e-6f * (fabsf(y_ref[i]) + 1.0f)) {
+                fprintf(stderr, "Kernel self-test: %s axpy/add failed for n = %d.\n", set->name, n);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// ----- Dispatch -----
+
+void initKernels(void) {
+    const KernelSet *candidates[4];
+    int count = 0;
+
+    // Fastest first; the scalar reference is always last
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) candidates[count++] = &avx512_kernels;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) candidates[count++] = &avx2_kernels;
+#endif
+#ifdef KERNELS_NEON
+    candidates[count++] = &neon_kernels;
+#endif
+    candidates[count++] = &scalar_kernels;
+
+    const char *forced = getenv("EMOTINET_KERNELS");
+    for (int i = 0; i < count; i++) {
+        if (forced && strcmp(forced, candidates[i]->name) != 0 && candidates[i] != &scalar_kernels) continue;
+        if (kernelSelfTest(candidates[i])) {
+            kernels = candidates[i];
+            break;
+        }
+    }
+
+    if (forced && strcmp(forced, kernels->name) != 0) {
+        fprintf(stderr, "Kernel set '%s' is not available, using '%s'.\n", forced, kernels->name);
+    }
+}
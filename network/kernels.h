@@ -0,0 +1,34 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stdint.h>
+
+// Set of vectorized math kernels used by the network
+// One set is chosen at startup by initKernels() based on what the CPU supports
+typedef struct {
+    const char *name;
+    // Returns sum of a[i] * b[i]
+    float (*dot)(const float *a, const float *b, int n);
+    // Returns sum of row[indices[k]] * values[k] (gathers the touched columns of a weight row)
+    float (*sparseDot)(const float *row, const uint32_t *indices, const float *values, int nnz);
+    // y[i] += a * x[i]
+    void (*axpy)(float *y, float a, const float *x, int n);
+    // y[i] += x[i]
+    void (*add)(float *y, const float *x, int n);
+    // x[i] = sigmoid(x[i]) via a rational approximation (absolute error below 1e-4)
+    void (*sigmoidFast)(float *x, int n);
+    // x[i] = max(x[i], 0)
+    void (*relu)(float *x, int n);
+} KernelSet;
+
+// Kernel set in use; points at the scalar reference until initKernels() runs
+extern const KernelSet *kernels;
+
+// Pick the fastest kernel set supported by this CPU that passes the self-test
+// Setting EMOTINET_KERNELS=scalar|avx2|avx512|neon in the environment forces a particular set
+void initKernels(void);
+
+// Compare every kernel of a set against the scalar reference; returns 1 if all agree
+int kernelSelfTest(const KernelSet *set);
+
+#endif
@@ -1,10 +1,60 @@
 #include "network.h"
+#include "kernels.h"
 #include <time.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// Huge page size used to round up huge-page backed parameter blocks
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Model file version written by saveNetworkBinary()
+// Version 1: architecture, vocabulary and unpadded weights, read field by field
+// Version 2: version 1 plus the hidden and output activation functions
+// Version 3: fixed header with section offsets; the parameter block is stored exactly as laid out
+//            in memory so loadNetworkBinary() can mmap the file and use it in place
+// Version 4: version 3 plus a minimal perfect hash of the vocabulary
+// Version 5: version 4 plus hash_bits; feature-hashed models have no vocabulary or index sections
+#define MODEL_FILE_VERSION 5
+
+// Size of the version 3 header, which ends before index_offset, and of the version 4 one, which ends before hash_bits
+#define MODEL_HEADER_V3_SIZE 88
+#define MODEL_HEADER_V4_SIZE 96
+
+// Header of a version 3 model file, followed by the sections it points at:
+//   uint32_t word_offsets[vocab_size]  offset of each word inside the string section
+//   char strings[strings_size]         NUL-terminated words
+//   uint32_t seeds[index_buckets]      perfect hash of the vocabulary (see perfectHash.h), at index_offset
+//   uint32_t slots[vocab_size]         (no vocabulary, index_buckets == 0, when hash_bits is set)
+//   float params[params_size / 4]      at a PARAM_ALIGNMENT-aligned offset, same layout as NeuralNetwork.params
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    int32_t input_nodes;
+    int32_t hidden_nodes;
+    int32_t output_nodes;
+    int32_t vocab_size;
+    uint32_t hidden_activation;
+    uint32_t output_activation;
+    uint32_t ih_stride;
+    uint32_t ho_stride;
+    uint32_t index_buckets;
+    uint64_t word_offsets_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t params_offset;
+    uint64_t params_size;
+    uint64_t index_offset;
+    uint32_t hash_bits;
+    uint32_t reserved;
+} ModelFileHeader;
 
 // Sigmoid activation function
 float sigmoid(float x) {
@@ -16,130 +66,171 @@ float sigmoid_derivative(float x) {
     return x * (1.0f - x);
 }
 
-// Helper function to multiply matrix and vector
-void matrixVectorMultiply(float *result, float **matrix, float *vector, int rows, int cols) {
+// Helper function to multiply a row-major matrix (with the given row stride) and vector
+void matrixVectorMultiply(float *result, const float *matrix, int stride, const float *vector, int rows, int cols) {
+    for (int i = 0; i < rows; i++) {
+        result[i] = kernels->dot(matrix + (size_t)i * stride, vector, cols);
+    }
+}
+
+// Helper function to multiply matrix and sparse vector, reading only the touched columns
+void sparseMatrixVectorMultiply(float *result, const float *matrix, int stride, const SparseInput *vector, int rows) {
     for (int i = 0; i < rows; i++) {
-        result[i] = 0.0f;
-        for (int j = 0; j < cols; j++) {
-            result[i] += matrix[i][j] * vector[j];
+        result[i] = kernels->sparseDot(matrix + (size_t)i * stride, vector->indices, vector->counts, vector->nnz);
+    }
+}
+
+// Round a row length up so that every row starts on a PARAM_ALIGNMENT boundary
+static int paddedStride(int cols) {
+    const int floats_per_line = PARAM_ALIGNMENT / sizeof(float);
+    return (cols + floats_per_line - 1) / floats_per_line * floats_per_line;
+}
+
+// Allocate the zeroed parameter block, optionally backed by huge pages
+static int allocateParams(NeuralNetwork *nn, size_t size, int use_huge_pages) {
+    nn->params_mapped = 0;
+
+    if (use_huge_pages) {
+        size_t mapped_size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        void *block = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        // Explicit huge pages, only available if the administrator reserved some
+        block = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        if (block == MAP_FAILED) {
+            // Fall back to transparent huge pages on a regular anonymous mapping
+            block = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+            if (block != MAP_FAILED) madvise(block, mapped_size, MADV_HUGEPAGE);
+#endif
+        }
+        if (block != MAP_FAILED) {
+            nn->params = (float*)block;
+            nn->params_size = mapped_size;
+            nn->params_mapped = 1;
+            return 1;
         }
+        fprintf(stderr, "Huge page allocation failed, using regular pages for parameters.\n");
     }
+
+    void *block = NULL;
+    if (posix_memalign(&block, PARAM_ALIGNMENT, size) != 0) {
+        perror("Memory allocation failed for network parameters");
+        return 0;
+    }
+    memset(block, 0, size);
+    nn->params = (float*)block;
+    nn->params_size = size;
+    return 1;
+}
+
+// Make an independent copy of a network, parameters included
+NeuralNetwork* copyNetwork(const NeuralNetwork *nn) {
+    NeuralNetwork *copy = (NeuralNetwork*)malloc(sizeof(NeuralNetwork));
+    if (!copy) {
+        perror("Memory allocation failed for NeuralNetwork copy");
+        return NULL;
+    }
+
+    *copy = *nn;
+    copy->model_mapping = NULL;
+    copy->model_mapping_size = 0;
+    memset(&copy->vocab_index, 0, sizeof(copy->vocab_index));
+    if (!allocateParams(copy, nn->params_size, 0)) {
+        free(copy);
+        return NULL;
+    }
+    memcpy(copy->params, nn->params, nn->params_size);
+
+    // Re-point the sections at the same offsets inside the new block
+    copy->weights_ih = copy->params + (nn->weights_ih - nn->params);
+    copy->weights_ho = copy->params + (nn->weights_ho - nn->params);
+    copy->hidden_bias = copy->params + (nn->hidden_bias - nn->params);
+    copy->output_bias = copy->params + (nn->output_bias - nn->params);
+    return copy;
 }
 
 // Create a new neural network
 NeuralNetwork* createNetwork(int input_nodes, int hidden_nodes, int output_nodes) {
+    return createNetworkWithOptions(input_nodes, hidden_nodes, output_nodes, 0);
+}
+
+// Size in bytes of the parameter block for the given architecture
+static size_t paramsBytes(int input_nodes, int hidden_nodes, int output_nodes) {
+    size_t ih_floats = (size_t)hidden_nodes * paddedStride(input_nodes);
+    size_t ho_floats = (size_t)output_nodes * paddedStride(hidden_nodes);
+    size_t hb_floats = paddedStride(hidden_nodes);
+    size_t ob_floats = paddedStride(output_nodes);
+    return (ih_floats + ho_floats + hb_floats + ob_floats) * sizeof(float);
+}
+
+// Point weights_ih, weights_ho, hidden_bias and output_bias at their sections of nn->params
+// The sections are laid out back to back, each one aligned
+static void layoutParams(NeuralNetwork *nn) {
+    nn->ih_stride = paddedStride(nn->input_nodes);
+    nn->ho_stride = paddedStride(nn->hidden_nodes);
+    nn->weights_ih = nn->params;
+    nn->weights_ho = nn->weights_ih + (size_t)nn->hidden_nodes * nn->ih_stride;
+    nn->hidden_bias = nn->weights_ho + (size_t)nn->output_nodes * nn->ho_stride;
+    nn->output_bias = nn->hidden_bias + paddedStride(nn->hidden_nodes);
+}
+
+// Create a network with zeroed parameters
+static NeuralNetwork* allocateNetwork(int input_nodes, int hidden_nodes, int output_nodes, int use_huge_pages) {
     NeuralNetwork* nn = (NeuralNetwork*)malloc(sizeof(NeuralNetwork));
     if (!nn) {
         perror("Memory allocation failed for NeuralNetwork");
         return NULL;
     }
 
-    srand((unsigned int)time(NULL)); // Seed for random number generation
-
     nn->input_nodes = input_nodes;
     nn->hidden_nodes = hidden_nodes;
     nn->output_nodes = output_nodes;
+    nn->hidden_activation = ACT_SIGMOID;
+    nn->output_activation = ACT_SIGMOID;
+    nn->model_mapping = NULL;
+    nn->model_mapping_size = 0;
+    memset(&nn->vocab_index, 0, sizeof(nn->vocab_index));
+    nn->hash_bits = 0;
 
-    // Allocate weights from Input to Hidden
-    nn->weights_ih = (float**)malloc(hidden_nodes * sizeof(float*));
-    if (!nn->weights_ih) {
-        perror("Memory allocation failed for weights_ih");
+    if (!allocateParams(nn, paramsBytes(input_nodes, hidden_nodes, output_nodes), use_huge_pages)) {
         free(nn);
         return NULL;
     }
+    layoutParams(nn);
+    return nn;
+}
 
-    for (int i = 0; i < hidden_nodes; i++) {
-        nn->weights_ih[i] = (float*)malloc(input_nodes * sizeof(float));
-        if (!nn->weights_ih[i]) {
-            perror("Memory allocation failed for weights_ih row");
-            // Free previously allocated rows
-            for (int j = 0; j < i; j++) {
-                free(nn->weights_ih[j]);
-            }
-            free(nn->weights_ih);
-            free(nn);
-            return NULL;
-        }
-        for (int j = 0; j < input_nodes; j++) {
-            nn->weights_ih[i][j] = 2.0f * ((float)rand() / RAND_MAX) - 1.0f; // Initialize weights between -1 and 1
-        }
+// Create a new neural network whose parameters are optionally backed by huge pages
+NeuralNetwork* createNetworkWithOptions(int input_nodes, int hidden_nodes, int output_nodes, int use_huge_pages) {
+    NeuralNetwork* nn = allocateNetwork(input_nodes, hidden_nodes, output_nodes, use_huge_pages);
+    if (!nn) {
+        return NULL;
     }
 
-    // Allocate weights from Hidden to Output
-    nn->weights_ho = (float**)malloc(output_nodes * sizeof(float*));
-    if (!nn->weights_ho) {
-        perror("Memory allocation failed for weights_ho");
-        // Free weights_ih
-        for (int i = 0; i < hidden_nodes; i++) {
-            free(nn->weights_ih[i]);
+    srand((unsigned int)time(NULL)); // Seed for random number generation
+
+    // Initialize weights and biases between -1 and 1 (row padding stays zero)
+    for (int i = 0; i < hidden_nodes; i++) {
+        float *row = nn->weights_ih + (size_t)i * nn->ih_stride;
+        for (int j = 0; j < input_nodes; j++) {
+            row[j] = 2.0f * ((float)rand() / RAND_MAX) - 1.0f;
         }
-        free(nn->weights_ih);
-        free(nn);
-        return NULL;
     }
 
     for (int i = 0; i < output_nodes; i++) {
-        nn->weights_ho[i] = (float*)malloc(hidden_nodes * sizeof(float));
-        if (!nn->weights_ho[i]) {
-            perror("Memory allocation failed for weights_ho row");
-            // Free previously allocated rows
-            for (int j = 0; j < i; j++) {
-                free(nn->weights_ho[j]);
-            }
-            free(nn->weights_ho);
-            // Free weights_ih
-            for (int j = 0; j < hidden_nodes; j++) {
-                free(nn->weights_ih[j]);
-            }
-            free(nn->weights_ih);
-            free(nn);
-            return NULL;
-        }
+        float *row = nn->weights_ho + (size_t)i * nn->ho_stride;
         for (int j = 0; j < hidden_nodes; j++) {
-            nn->weights_ho[i][j] = 2.0f * ((float)rand() / RAND_MAX) - 1.0f; // Initialize weights between -1 and 1
+            row[j] = 2.0f * ((float)rand() / RAND_MAX) - 1.0f;
         }
     }
 
-    // Allocate and initialize biases
-    nn->hidden_bias = (float*)malloc(hidden_nodes * sizeof(float));
-    if (!nn->hidden_bias) {
-        perror("Memory allocation failed for hidden_bias");
-        // Free weights_ho and weights_ih
-        for (int i = 0; i < output_nodes; i++) {
-            free(nn->weights_ho[i]);
-        }
-        free(nn->weights_ho);
-        for (int i = 0; i < hidden_nodes; i++) {
-            free(nn->weights_ih[i]);
-        }
-        free(nn->weights_ih);
-        free(nn);
-        return NULL;
-    }
-
     for (int i = 0; i < hidden_nodes; i++) {
-        nn->hidden_bias[i] = 2.0f * ((float)rand() / RAND_MAX) - 1.0f; // Initialize biases between -1 and 1
-    }
-
-    nn->output_bias = (float*)malloc(output_nodes * sizeof(float));
-    if (!nn->output_bias) {
-        perror("Memory allocation failed for output_bias");
-        // Free hidden_bias, weights_ho and weights_ih
-        free(nn->hidden_bias);
-        for (int i = 0; i < output_nodes; i++) {
-            free(nn->weights_ho[i]);
-        }
-        free(nn->weights_ho);
-        for (int i = 0; i < hidden_nodes; i++) {
-            free(nn->weights_ih[i]);
-        }
-        free(nn->weights_ih);
-        free(nn);
-        return NULL;
+        nn->hidden_bias[i] = 2.0f * ((float)rand() / RAND_MAX) - 1.0f;
     }
 
     for (int i = 0; i < output_nodes; i++) {
-        nn->output_bias[i] = 2.0f * ((float)rand() / RAND_MAX) - 1.0f; // Initialize biases between -1 and 1
+        nn->output_bias[i] = 2.0f * ((float)rand() / RAND_MAX) - 1.0f;
     }
 
     return nn;
@@ -154,19 +245,15 @@ void train(NeuralNetwork* nn, float **inputs, float **targets, int num_samples,
             // ----- Feedforward -----
             // Calculate Hidden Layer Activations
             float hidden_inputs[nn->hidden_nodes];
-            matrixVectorMultiply(hidden_inputs, nn->weights_ih, inputs[sample], nn->hidden_nodes, nn->input_nodes);
-            for (int i = 0; i < nn->hidden_nodes; i++) {
-                hidden_inputs[i] += nn->hidden_bias[i];
-                hidden_inputs[i] = sigmoid(hidden_inputs[i]);
-            }
+            matrixVectorMultiply(hidden_inputs, nn->weights_ih, nn->ih_stride, inputs[sample], nn->hidden_nodes, nn->input_nodes);
+            kernels->add(hidden_inputs, nn->hidden_bias, nn->hidden_nodes);
+            activate(nn->hidden_activation, hidden_inputs, nn->hidden_nodes);
 
             // Calculate Output Layer Activations
             float output_inputs[nn->output_nodes];
-            matrixVectorMultiply(output_inputs, nn->weights_ho, hidden_inputs, nn->output_nodes, nn->hidden_nodes);
-            for (int i = 0; i < nn->output_nodes; i++) {
-                output_inputs[i] += nn->output_bias[i];
-                output_inputs[i] = sigmoid(output_inputs[i]);
-            }
+            matrixVectorMultiply(output_inputs, nn->weights_ho, nn->ho_stride, hidden_inputs, nn->output_nodes, nn->hidden_nodes);
+            kernels->add(output_inputs, nn->output_bias, nn->output_nodes);
+            activate(nn->output_activation, output_inputs, nn->output_nodes);
 
             // ----- Calculate Error -----
             float output_errors[nn->output_nodes];
@@ -178,39 +265,31 @@ void train(NeuralNetwork* nn, float **inputs, float **targets, int num_samples,
             // ----- Backpropagation -----
             // Calculate gradients for output layer
             float output_gradients[nn->output_nodes];
-            for (int i = 0; i < nn->output_nodes; i++) {
-                output_gradients[i] = output_errors[i] * sigmoid_derivative(output_inputs[i]);
-            }
+            memcpy(output_gradients, output_errors, sizeof(output_gradients));
+            activationGradient(nn->output_activation, output_inputs, output_gradients, nn->output_nodes);
 
-            // Calculate errors for hidden layer
+            // Calculate errors for hidden layer, accumulating weights_ho row by row
             float hidden_errors[nn->hidden_nodes];
-            for (int i = 0; i < nn->hidden_nodes; i++) {
-                hidden_errors[i] = 0.0f;
-                for (int j = 0; j < nn->output_nodes; j++) {
-                    hidden_errors[i] += nn->weights_ho[j][i] * output_errors[j];
-                }
+            memset(hidden_errors, 0, sizeof(hidden_errors));
+            for (int j = 0; j < nn->output_nodes; j++) {
+                kernels->axpy(hidden_errors, output_errors[j], nn->weights_ho + (size_t)j * nn->ho_stride, nn->hidden_nodes);
             }
 
             // Calculate gradients for hidden layer
             float hidden_gradients[nn->hidden_nodes];
-            for (int i = 0; i < nn->hidden_nodes; i++) {
-                hidden_gradients[i] = hidden_errors[i] * sigmoid_derivative(hidden_inputs[i]);
-            }
+            memcpy(hidden_gradients, hidden_errors, sizeof(hidden_gradients));
+            activationGradient(nn->hidden_activation, hidden_inputs, hidden_gradients, nn->hidden_nodes);
 
             // ----- Update Weights and Biases -----
             // Update weights from Hidden to Output
             for (int i = 0; i < nn->output_nodes; i++) {
-                for (int j = 0; j < nn->hidden_nodes; j++) {
-                    nn->weights_ho[i][j] += learning_rate * output_gradients[i] * hidden_inputs[j];
-                }
+                kernels->axpy(nn->weights_ho + (size_t)i * nn->ho_stride, learning_rate * output_gradients[i], hidden_inputs, nn->hidden_nodes);
                 nn->output_bias[i] += learning_rate * output_gradients[i];
             }
 
             // Update weights from Input to Hidden
             for (int i = 0; i < nn->hidden_nodes; i++) {
-                for (int j = 0; j < nn->input_nodes; j++) {
-                    nn->weights_ih[i][j] += learning_rate * hidden_gradients[i] * inputs[sample][j];
-                }
+                kernels->axpy(nn->weights_ih + (size_t)i * nn->ih_stride, learning_rate * hidden_gradients[i], inputs[sample], nn->input_nodes);
                 nn->hidden_bias[i] += learning_rate * hidden_gradients[i];
             }
         }
@@ -221,6 +300,950 @@ void train(NeuralNetwork* nn, float **inputs, float **targets, int num_samples,
     }
 }
 
+// Per-batch scratch buffers used during training (row b holds sample b of the batch)
+typedef struct {
+    int capacity;            // Maximum number of samples per batch
+    SparseInput *rows;       // Views of the batch's rows in the training set
+    float *hidden;           // capacity x hidden_nodes activations
+    float *output;           // capacity x output_nodes activations
+    float *hidden_gradients; // capacity x hidden_nodes
+    float *output_gradients; // capacity x output_nodes
+} BatchWorkspace;
+
+static void freeBatchWorkspace(BatchWorkspace *ws) {
+    free(ws->rows);
+    free(ws->hidden);
+    free(ws->output);
+    free(ws->hidden_gradients);
+    free(ws->output_gradients);
+}
+
+// Allocate per-batch scratch buffers for up to capacity samples
+static int createBatchWorkspace(BatchWorkspace *ws, NeuralNetwork *nn, int capacity) {
+    ws->capacity = capacity;
+    ws->rows = (SparseInput*)malloc(capacity * sizeof(SparseInput));
+    ws->hidden = (float*)malloc((size_t)capacity * nn->hidden_nodes * sizeof(float));
+    ws->output = (float*)malloc((size_t)capacity * nn->output_nodes * sizeof(float));
+    ws->hidden_gradients = (float*)malloc((size_t)capacity * nn->hidden_nodes * sizeof(float));
+    ws->output_gradients = (float*)malloc((size_t)capacity * nn->output_nodes * sizeof(float));
+    if (!ws->rows || !ws->hidden || !ws->output || !ws->hidden_gradients || !ws->output_gradients) {
+        perror("Memory allocation failed for batch workspace");
+        freeBatchWorkspace(ws);
+        return 0;
+    }
+    return 1;
+}
+
+// Point the workspace's row views at samples [first, first + count) of the training set
+static const SparseInput* batchRows(BatchWorkspace *ws, const TrainingSet *data, int first, int count) {
+    for (int b = 0; b < count; b++) {
+        ws->rows[b] = trainingSetRow(data, first + b);
+    }
+    return ws->rows;
+}
+
+// Hidden layer for a tile of sparse samples: hidden[b * H + i], bias and activation applied
+// This is an SpMM: each weights_ih row is swept once for the whole tile
+static void sparseHiddenTile(NeuralNetwork *nn, const SparseInput *inputs, int count, float *hidden) {
+    int H = nn->hidden_nodes;
+
+    for (int i = 0; i < H; i++) {
+        const float *row = nn->weights_ih + (size_t)i * nn->ih_stride;
+        for (int b = 0; b < count; b++) {
+            hidden[(size_t)b * H + i] = kernels->sparseDot(row, inputs[b].indices, inputs[b].counts, inputs[b].nnz);
+        }
+    }
+
+    for (int b = 0; b < count; b++) {
+        kernels->add(hidden + (size_t)b * H, nn->hidden_bias, H);
+        activate(nn->hidden_activation, hidden + (size_t)b * H, H);
+    }
+}
+
+// Hidden layer for a tile of dense samples
+// Each weights_ih row is loaded once and reused from cache for every sample of the tile
+static void denseHiddenTile(NeuralNetwork *nn, float **inputs, int count, float *hidden) {
+    int H = nn->hidden_nodes;
+
+    for (int i = 0; i < H; i++) {
+        const float *row = nn->weights_ih + (size_t)i * nn->ih_stride;
+        for (int b = 0; b < count; b++) {
+            hidden[(size_t)b * H + i] = kernels->dot(row, inputs[b], nn->input_nodes);
+        }
+    }
+
+    for (int b = 0; b < count; b++) {
+        kernels->add(hidden + (size_t)b * H, nn->hidden_bias, H);
+        activate(nn->hidden_activation, hidden + (size_t)b * H, H);
+    }
+}
+
+// Output layer for a tile: output[b * O + i] from the tile's hidden activations
+static void outputTile(NeuralNetwork *nn, const float *hidden, int count, float *output) {
+    int H = nn->hidden_nodes;
+    int O = nn->output_nodes;
+
+    for (int b = 0; b < count; b++) {
+        float *out = output + (size_t)b * O;
+        matrixVectorMultiply(out, nn->weights_ho, nn->ho_stride, hidden + (size_t)b * H, O, H);
+        kernels->add(out, nn->output_bias, O);
+        activate(nn->output_activation, out, O);
+    }
+}
+
+// Forward pass for a batch of sparse samples
+static void forwardSparseBatch(NeuralNetwork *nn, const SparseInput *inputs, int count, BatchWorkspace *ws) {
+    sparseHiddenTile(nn, inputs, count, ws->hidden);
+    outputTile(nn, ws->hidden, count, ws->output);
+}
+
+// Backpropagate a batch, filling the per-sample gradients; returns the summed squared error
+static float backwardBatch(NeuralNetwork *nn, const uint8_t *labels, int count, BatchWorkspace *ws) {
+    int H = nn->hidden_nodes;
+    int O = nn->output_nodes;
+    float total_error = 0.0f;
+
+    for (int b = 0; b < count; b++) {
+        const float *hidden = ws->hidden + (size_t)b * H;
+        const float *output = ws->output + (size_t)b * O;
+        float *output_gradients = ws->output_gradients + (size_t)b * O;
+        float *hidden_gradients = ws->hidden_gradients + (size_t)b * H;
+
+        // Calculate error and gradients for output layer against the one-hot target of the label
+        float output_errors[O];
+        for (int i = 0; i < O; i++) {
+            output_errors[i] = (i == labels[b] ? 1.0f : 0.0f) - output[i];
+            total_error += output_errors[i] * output_errors[i];
+            output_gradients[i] = output_errors[i];
+        }
+        activationGradient(nn->output_activation, output, output_gradients, O);
+
+        // Calculate errors and gradients for hidden layer, accumulating weights_ho row by row
+        memset(hidden_gradients, 0, H * sizeof(float));
+        for (int j = 0; j < O; j++) {
+            kernels->axpy(hidden_gradients, output_errors[j], nn->weights_ho + (size_t)j * nn->ho_stride, H);
+        }
+        activationGradient(nn->hidden_activation, hidden, hidden_gradients, H);
+    }
+
+    return total_error;
+}
+
+// Apply the averaged batch gradients in one update, touching only the weights_ih columns seen in the batch
+static void updateSparseBatch(NeuralNetwork *nn, const SparseInput *inputs, int count, float learning_rate, BatchWorkspace *ws) {
+    int H = nn->hidden_nodes;
+    int O = nn->output_nodes;
+    float scale = learning_rate / count;
+
+    // Update weights from Hidden to Output
+    for (int i = 0; i < O; i++) {
+        float *row = nn->weights_ho + (size_t)i * nn->ho_stride;
+        for (int b = 0; b < count; b++) {
+            float gradient = scale * ws->output_gradients[(size_t)b * O + i];
+            kernels->axpy(row, gradient, ws->hidden + (size_t)b * H, H);
+            nn->output_bias[i] += gradient;
+        }
+    }
+
+    // Update weights from Input to Hidden, again sweeping each row once per batch
+    for (int i = 0; i < H; i++) {
+        float *row = nn->weights_ih + (size_t)i * nn->ih_stride;
+        for (int b = 0; b < count; b++) {
+            const SparseInput *input = &inputs[b];
+            float gradient = scale * ws->hidden_gradients[(size_t)b * H + i];
+            for (int k = 0; k < input->nnz; k++) {
+                row[input->indices[k]] += gradient * input->counts[k];
+            }
+            nn->hidden_bias[i] += gradient;
+        }
+    }
+}
+
+// State for one training thread: a contiguous shard of the samples and private scratch buffers
+typedef struct {
+    NeuralNetwork *nn;
+    const TrainingSet *data;
+    int first;           // First sample of the shard
+    int last;            // One past the last sample of the shard
+    int batch_size;
+    float learning_rate;
+    BatchWorkspace ws;
+    float total_error;   // Summed squared error over the shard for the current epoch
+} TrainWorker;
+
+// Run one epoch of mini-batch training over a worker's shard
+// In Hogwild mode several workers run this concurrently and update the shared parameters without locks;
+// bag-of-words batches mostly touch disjoint weights_ih columns, so the occasional lost update is tolerated
+static void *trainWorkerEpoch(void *arg) {
+    TrainWorker *worker = (TrainWorker*)arg;
+    worker->total_error = 0.0f;
+
+    for (int first = worker->first; first < worker->last; first += worker->batch_size) {
+        int count = worker->last - first < worker->batch_size ? worker->last - first : worker->batch_size;
+
+        const SparseInput *rows = batchRows(&worker->ws, worker->data, first, count);
+        forwardSparseBatch(worker->nn, rows, count, &worker->ws);
+        worker->total_error += backwardBatch(worker->nn, worker->data->labels + first, count, &worker->ws);
+        updateSparseBatch(worker->nn, rows, count, worker->learning_rate, &worker->ws);
+    }
+    return NULL;
+}
+
+// Run one epoch on all workers and return the summed squared error
+// A single worker runs on the calling thread, which keeps the sequential path free of threading overhead
+static float runTrainEpoch(TrainWorker *workers, int num_workers) {
+    pthread_t threads[num_workers];
+    int started[num_workers];
+
+    for (int t = 1; t < num_workers; t++) {
+        started[t] = pthread_create(&threads[t], NULL, trainWorkerEpoch, &workers[t]) == 0;
+        if (!started[t]) {
+            // Could not spawn a thread: run its shard after our own instead
+            fprintf(stderr, "Failed to start training thread %d, running its shard inline.\n", t);
+        }
+    }
+    trainWorkerEpoch(&workers[0]);
+
+    float total_error = workers[0].total_error;
+    for (int t = 1; t < num_workers; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        }
+        else {
+            trainWorkerEpoch(&workers[t]);
+        }
+        total_error += workers[t].total_error;
+    }
+    return total_error;
+}
+
+// Split the samples into one contiguous shard per worker and allocate their workspaces
+static TrainWorker* createTrainWorkers(NeuralNetwork *nn, const TrainingSet *data, const TrainOptions *options, int num_workers) {
+    int num_samples = data->num_samples;
+    int batch_size = options->batch_size > 0 ? options->batch_size : 1;
+
+    TrainWorker *workers = (TrainWorker*)calloc(num_workers, sizeof(TrainWorker));
+    if (!workers) {
+        perror("Memory allocation failed for training workers");
+        return NULL;
+    }
+
+    for (int t = 0; t < num_workers; t++) {
+        workers[t].nn = nn;
+        workers[t].data = data;
+        workers[t].first = (int)((long long)num_samples * t / num_workers);
+        workers[t].last = (int)((long long)num_samples * (t + 1) / num_workers);
+        workers[t].batch_size = batch_size;
+        workers[t].learning_rate = options->learning_rate;
+        if (!createBatchWorkspace(&workers[t].ws, nn, batch_size)) {
+            for (int j = 0; j < t; j++) {
+                freeBatchWorkspace(&workers[j].ws);
+            }
+            free(workers);
+            return NULL;
+        }
+    }
+    return workers;
+}
+
+static void freeTrainWorkers(TrainWorker *workers, int num_workers) {
+    for (int t = 0; t < num_workers; t++) {
+        freeBatchWorkspace(&workers[t].ws);
+    }
+    free(workers);
+}
+
+// Number of workers actually used for a training run
+static int trainWorkerCount(int num_threads, int num_samples) {
+    if (num_threads < 1) num_threads = 1;
+    if (num_threads > num_samples) num_threads = num_samples > 0 ? num_samples : 1;
+    return num_threads;
+}
+
+// Monotonic wall-clock time in seconds, for throughput reporting
+static double wallSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Samples per gradient leaf in synchronous mode
+// Leaves are the unit of parallel work and are fixed regardless of thread count, which is what makes the
+// reduction order (and therefore the trained weights) independent of how many threads run
+#define SYNC_LEAF_SAMPLES 32
+
+// Shared state for synchronous data-parallel training
+// Gradients of each leaf go into a private buffer laid out as weights_ih (hidden_nodes x num_columns, only the
+// columns touched by the batch), weights_ho (output_nodes x hidden_nodes), hidden_bias, output_bias
+typedef struct {
+    NeuralNetwork *nn;
+    const TrainingSet *data;
+    int num_samples;
+    int batch_size;
+    int num_threads;            // Threads the trainer has workspaces for
+    int active_threads;         // Threads running the current epoch
+    float learning_rate;
+    pthread_mutex_t start_gate; // Held while an epoch's threads are being started
+    pthread_barrier_t barrier;  // Re-created every epoch for the threads that started
+    BatchWorkspace *workspaces; // One per thread
+    int *column_slot;           // Per input node: position in columns, or -1 if not in the current batch
+    uint32_t *columns;          // weights_ih columns touched by the current batch, in first-seen order
+    int num_columns;
+    float **leaf_gradients;     // max_leaves gradient buffers
+    float *leaf_errors;         // Summed squared error of each leaf
+    size_t leaf_capacity;       // Floats allocated per gradient buffer
+    int max_leaves;
+    int first;                  // First sample of the current batch
+    int count;                  // Samples in the current batch
+    int num_leaves;             // Leaves in the current batch
+    size_t gradient_length;     // Floats used per gradient buffer for the current batch
+    int failed;                 // Set when buffers could not be grown; all threads stop
+    float epoch_error;
+} SyncTrainer;
+
+typedef struct {
+    SyncTrainer *st;
+    int thread;
+} SyncWorker;
+
+// Collect the columns touched by the next batch and size the leaf buffers for it (runs on thread 0 only)
+static void prepareSyncBatch(SyncTrainer *st, int first) {
+    NeuralNetwork *nn = st->nn;
+
+    // Forget the previous batch's columns
+    for (int u = 0; u < st->num_columns; u++) {
+        st->column_slot[st->columns[u]] = -1;
+    }
+    st->num_columns = 0;
+
+    st->first = first;
+    st->count = st->num_samples - first < st->batch_size ? st->num_samples - first : st->batch_size;
+    st->num_leaves = (st->count + SYNC_LEAF_SAMPLES - 1) / SYNC_LEAF_SAMPLES;
+
+    // The batch's rows are contiguous in the training set, so scan their indices in one run
+    const TrainingSet *data = st->data;
+    for (size_t k = data->row_offsets[first]; k < data->row_offsets[first + st->count]; k++) {
+        uint32_t column = data->indices[k];
+        if (st->column_slot[column] < 0) {
+            st->column_slot[column] = st->num_columns;
+            st->columns[st->num_columns++] = column;
+        }
+    }
+
+    st->gradient_length = (size_t)nn->hidden_nodes * st->num_columns + (size_t)nn->output_nodes * nn->hidden_nodes
+                          + nn->hidden_nodes + nn->output_nodes;
+    if (st->gradient_length > st->leaf_capacity) {
+        for (int l = 0; l < st->max_leaves; l++) {
+            float *grown = (float*)realloc(st->leaf_gradients[l], st->gradient_length * sizeof(float));
+            if (!grown) {
+                perror("Reallocation failed for synchronous gradient buffers");
+                st->failed = 1;
+                return;
+            }
+            st->leaf_gradients[l] = grown;
+        }
+        st->leaf_capacity = st->gradient_length;
+    }
+}
+
+// Forward and backward pass over one leaf, accumulating its gradients in sample order
+static void computeLeafGradients(SyncTrainer *st, int thread, int leaf) {
+    NeuralNetwork *nn = st->nn;
+    BatchWorkspace *ws = &st->workspaces[thread];
+    int H = nn->hidden_nodes;
+    int O = nn->output_nodes;
+    int U = st->num_columns;
+
+    int first = st->first + leaf * SYNC_LEAF_SAMPLES;
+    int end = st->first + st->count;
+    int count = end - first < SYNC_LEAF_SAMPLES ? end - first : SYNC_LEAF_SAMPLES;
+    const SparseInput *inputs = batchRows(ws, st->data, first, count);
+
+    forwardSparseBatch(nn, inputs, count, ws);
+    st->leaf_errors[leaf] = backwardBatch(nn, st->data->labels + first, count, ws);
+
+    float *grad_ih = st->leaf_gradients[leaf];
+    float *grad_ho = grad_ih + (size_t)H * U;
+    float *grad_hb = grad_ho + (size_t)O * H;
+    float *grad_ob = grad_hb + H;
+    memset(grad_ih, 0, st->gradient_length * sizeof(float));
+
+    for (int b = 0; b < count; b++) {
+        const float *hidden = ws->hidden + (size_t)b * H;
+        for (int i = 0; i < O; i++) {
+            float gradient = ws->output_gradients[(size_t)b * O + i];
+            kernels->axpy(grad_ho + (size_t)i * H, gradient, hidden, H);
+            grad_ob[i] += gradient;
+        }
+
+        const SparseInput *input = &inputs[b];
+        for (int i = 0; i < H; i++) {
+            float gradient = ws->hidden_gradients[(size_t)b * H + i];
+            float *row = grad_ih + (size_t)i * U;
+            for (int k = 0; k < input->nnz; k++) {
+                row[st->column_slot[input->indices[k]]] += gradient * input->counts[k];
+            }
+            grad_hb[i] += gradient;
+        }
+    }
+}
+
+// Reduce the leaf buffers over [lo, hi) with a fixed pairwise tree, then apply the result to the parameters
+// Every thread owns a disjoint element range, so no synchronization is needed between tree levels
+static void reduceAndApplyRange(SyncTrainer *st, size_t lo, size_t hi) {
+    NeuralNetwork *nn = st->nn;
+    int H = nn->hidden_nodes;
+    int U = st->num_columns;
+    float **leaves = st->leaf_gradients;
+
+    for (int stride = 1; stride < st->num_leaves; stride *= 2) {
+        for (int l = 0; l + stride < st->num_leaves; l += 2 * stride) {
+            kernels->add(leaves[l] + lo, leaves[l + stride] + lo, (int)(hi - lo));
+        }
+    }
+
+    const float *gradient = leaves[0];
+    float scale = st->learning_rate / st->count;
+    size_t ih_end = (size_t)H * U;
+    size_t ho_end = ih_end + (size_t)nn->output_nodes * H;
+    size_t hb_end = ho_end + H;
+    size_t e = lo;
+
+    // weights_ih: element i * U + u belongs to row i, column columns[u]
+    while (e < hi && e < ih_end) {
+        size_t i = e / U;
+        size_t row_end = (i + 1) * U < hi ? (i + 1) * U : hi;
+        float *row = nn->weights_ih + i * nn->ih_stride;
+        for (; e < row_end; e++) {
+            row[st->columns[e - i * U]] += scale * gradient[e];
+        }
+    }
+
+    // weights_ho: element ih_end + i * H + j belongs to row i, column j
+    while (e < hi && e < ho_end) {
+        size_t i = (e - ih_end) / H;
+        size_t row_end = ih_end + (i + 1) * H < hi ? ih_end + (i + 1) * H : hi;
+        float *row = nn->weights_ho + i * nn->ho_stride;
+        for (; e < row_end; e++) {
+            row[e - ih_end - i * H] += scale * gradient[e];
+        }
+    }
+
+    for (; e < hi && e < hb_end; e++) {
+        nn->hidden_bias[e - ho_end] += scale * gradient[e];
+    }
+    for (; e < hi; e++) {
+        nn->output_bias[e - hb_end] += scale * gradient[e];
+    }
+}
+
+// One epoch of synchronous training as seen by one thread; all threads step through the batches in lockstep
+static void *syncWorkerEpoch(void *arg) {
+    SyncWorker *worker = (SyncWorker*)arg;
+    SyncTrainer *st = worker->st;
+    int t = worker->thread;
+
+    // Wait until the epoch's barrier is set up for the threads that actually started
+    pthread_mutex_lock(&st->start_gate);
+    pthread_mutex_unlock(&st->start_gate);
+    if (st->failed) return NULL;
+    int T = st->active_threads;
+
+    for (int first = 0; first < st->num_samples; first += st->batch_size) {
+        if (t == 0) {
+            prepareSyncBatch(st, first);
+        }
+        pthread_barrier_wait(&st->barrier);
+        if (st->failed) break;
+
+        for (int leaf = t; leaf < st->num_leaves; leaf += T) {
+            computeLeafGradients(st, t, leaf);
+        }
+        pthread_barrier_wait(&st->barrier);
+
+        reduceAndApplyRange(st, st->gradient_length * t / T, st->gradient_length * (t + 1) / T);
+        pthread_barrier_wait(&st->barrier);
+
+        // Leaf errors are summed in leaf order so the reported MSE is reproducible too
+        if (t == 0) {
+            for (int leaf = 0; leaf < st->num_leaves; leaf++) {
+                st->epoch_error += st->leaf_errors[leaf];
+            }
+        }
+    }
+    return NULL;
+}
+
+static void freeSyncTrainer(SyncTrainer *st) {
+    if (st->workspaces) {
+        for (int t = 0; t < st->num_threads; t++) {
+            freeBatchWorkspace(&st->workspaces[t]);
+        }
+    }
+    if (st->leaf_gradients) {
+        for (int l = 0; l < st->max_leaves; l++) {
+            free(st->leaf_gradients[l]);
+        }
+    }
+    free(st->workspaces);
+    free(st->leaf_gradients);
+    free(st->leaf_errors);
+    free(st->column_slot);
+    free(st->columns);
+    pthread_mutex_destroy(&st->start_gate);
+}
+
+static int createSyncTrainer(SyncTrainer *st, NeuralNetwork *nn, const TrainingSet *data, const TrainOptions *options) {
+    memset(st, 0, sizeof(*st));
+    st->nn = nn;
+    st->data = data;
+    st->num_samples = data->num_samples;
+    st->batch_size = options->batch_size > 0 ? options->batch_size : 1;
+    st->num_threads = options->num_threads > 1 ? options->num_threads : 1;
+    st->learning_rate = options->learning_rate;
+    st->max_leaves = (st->batch_size + SYNC_LEAF_SAMPLES - 1) / SYNC_LEAF_SAMPLES;
+
+    pthread_mutex_init(&st->start_gate, NULL);
+
+    st->workspaces = (BatchWorkspace*)calloc(st->num_threads, sizeof(BatchWorkspace));
+    st->leaf_gradients = (float**)calloc(st->max_leaves, sizeof(float*));
+    st->leaf_errors = (float*)calloc(st->max_leaves, sizeof(float));
+    st->column_slot = (int*)malloc(nn->input_nodes * sizeof(int));
+    st->columns = (uint32_t*)malloc(nn->input_nodes * sizeof(uint32_t));
+    if (!st->workspaces || !st->leaf_gradients || !st->leaf_errors || !st->column_slot || !st->columns) {
+        perror("Memory allocation failed for synchronous trainer");
+        freeSyncTrainer(st);
+        return 0;
+    }
+
+    for (int t = 0; t < st->num_threads; t++) {
+        if (!createBatchWorkspace(&st->workspaces[t], nn, SYNC_LEAF_SAMPLES)) {
+            freeSyncTrainer(st);
+            return 0;
+        }
+    }
+    for (int i = 0; i < nn->input_nodes; i++) {
+        st->column_slot[i] = -1;
+    }
+    return 1;
+}
+
+// Run one synchronous epoch on all threads and return the summed squared error, or a negative value on failure
+static float runSyncEpoch(SyncTrainer *st, int num_threads) {
+    pthread_t threads[num_threads];
+    SyncWorker workers[num_threads];
+
+    st->epoch_error = 0.0f;
+    for (int t = 0; t < num_threads; t++) {
+        workers[t].st = st;
+        workers[t].thread = t;
+    }
+
+    // Hold the workers at the start gate until we know how many actually started; the barrier must count
+    // exactly those. Leaves do not depend on the thread count, so running with fewer threads gives the same result
+    pthread_mutex_lock(&st->start_gate);
+    int started = 1;
+    while (started < num_threads && pthread_create(&threads[started], NULL, syncWorkerEpoch, &workers[started]) == 0) {
+        started++;
+    }
+    if (started < num_threads) {
+        fprintf(stderr, "Started only %d of %d synchronous training threads.\n", started, num_threads);
+    }
+    st->active_threads = started;
+    if (pthread_barrier_init(&st->barrier, NULL, started) != 0) {
+        fprintf(stderr, "Failed to initialize training barrier.\n");
+        st->failed = 1;
+    }
+    pthread_mutex_unlock(&st->start_gate);
+
+    if (!st->failed) {
+        syncWorkerEpoch(&workers[0]);
+    }
+    for (int t = 1; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    if (!st->failed) {
+        pthread_barrier_destroy(&st->barrier);
+    }
+    return st->failed ? -1.0f : st->epoch_error;
+}
+
+// Train the neural network on sparse bag-of-words samples with mini-batch gradient descent
+// Only the weights_ih columns of tokens present in a batch are read or updated; a batch size of 1 is per-sample SGD.
+// TRAIN_HOGWILD with num_threads > 1 trains one shard per thread lock-free; one thread is the plain sequential case.
+// TRAIN_SYNC splits every batch across the threads and gives bit-identical weights for any thread count
+void trainSparse(NeuralNetwork* nn, const TrainingSet *data, const TrainOptions *options) {
+    int num_samples = data->num_samples;
+    int num_workers = 0;
+    TrainWorker *workers = NULL;
+    SyncTrainer sync;
+
+    if (options->mode == TRAIN_SYNC) {
+        if (!createSyncTrainer(&sync, nn, data, options)) {
+            fprintf(stderr, "Training aborted.\n");
+            return;
+        }
+        num_workers = options->num_threads > 1 ? options->num_threads : 1;
+    }
+    else {
+        num_workers = trainWorkerCount(options->num_threads, num_samples);
+        workers = createTrainWorkers(nn, data, options, num_workers);
+        if (!workers) {
+            fprintf(stderr, "Training aborted.\n");
+            return;
+        }
+    }
+
+    for (int epoch = 0; epoch < options->epochs; epoch++) {
+        double start = wallSeconds();
+        float total_error = workers ? runTrainEpoch(workers, num_workers) : runSyncEpoch(&sync, num_workers);
+        double elapsed = wallSeconds() - start;
+        if (total_error < 0.0f) {
+            fprintf(stderr, "Training aborted.\n");
+            break;
+        }
+
+        // Calculate Mean Squared Error for the epoch
+        float mse = total_error / num_samples;
+        printf("Epoch %d/%d, MSE: %f, %.0f samples/s (%d thread%s)\n", epoch + 1, options->epochs, mse,
+               elapsed > 0.0 ? num_samples / elapsed : 0.0, num_workers, num_workers == 1 ? "" : "s");
+    }
+
+    if (workers) {
+        freeTrainWorkers(workers, num_workers);
+    }
+    else {
+        freeSyncTrainer(&sync);
+    }
+}
+
+// Measure Hogwild training throughput for 1, 2, 4, ... max_threads threads
+// Each thread count trains one epoch on its own copy of nn, so the network passed in is left untouched
+void reportHogwildScaling(NeuralNetwork *nn, const TrainingSet *data, const TrainOptions *options, int max_threads) {
+    int num_samples = data->num_samples;
+    printf("Threads  Samples/s  Speedup\n");
+
+    if (max_threads < 1) max_threads = 1;
+
+    double baseline = 0.0;
+    for (int threads = 1; ; threads *= 2) {
+        if (threads > max_threads) threads = max_threads;
+
+        int num_workers = trainWorkerCount(threads, num_samples);
+        NeuralNetwork *scratch = copyNetwork(nn);
+        TrainWorker *workers = scratch ? createTrainWorkers(scratch, data, options, num_workers) : NULL;
+        if (!workers) {
+            fprintf(stderr, "Scaling report aborted.\n");
+            freeNetwork(scratch);
+            return;
+        }
+
+        double start = wallSeconds();
+        runTrainEpoch(workers, num_workers);
+        double elapsed = wallSeconds() - start;
+        double throughput = elapsed > 0.0 ? num_samples / elapsed : 0.0;
+        if (threads == 1) baseline = throughput;
+
+        printf("%7d  %9.0f  %6.2fx\n", num_workers, throughput, baseline > 0.0 ? throughput / baseline : 0.0);
+
+        freeTrainWorkers(workers, num_workers);
+        freeNetwork(scratch);
+        if (threads == max_threads) break;
+    }
+}
+
+// Cache lines of weights_ih holding the hottest columns that together cover 90% of token occurrences
+// position[c] is where column c sits; hot lists columns by descending occurrences
+static size_t hotLines(const NeuralNetwork *nn, const uint32_t *hot, const double *occurrences, double total, const uint32_t *position) {
+    size_t lines_per_row = ((size_t)nn->ih_stride * sizeof(float) + 63) / 64;
+    uint8_t *touched = (uint8_t*)calloc(lines_per_row, 1);
+    if (!touched) return 0;
+    size_t lines = 0;
+    double covered = 0.0;
+    for (int k = 0; k < nn->input_nodes && covered < 0.9 * total; k++) {
+        size_t line = (size_t)position[hot[k]] * sizeof(float) / 64;
+        if (!touched[line]) {
+            touched[line] = 1;
+            lines++;
+        }
+        covered += occurrences[hot[k]];
+    }
+    free(touched);
+    return lines * nn->hidden_nodes; // The same columns of every row
+}
+
+typedef struct {
+    double occurrences;
+    uint32_t column;
+} ColumnUse;
+
+// Most used first
+static int compareColumnUse(const void *a, const void *b) {
+    double x = ((const ColumnUse*)a)->occurrences;
+    double y = ((const ColumnUse*)b)->occurrences;
+    return (x < y) - (x > y);
+}
+
+// Best-of-three seconds for predictBatchSparse over the whole set and for one single-threaded training epoch
+static int timeSparsePaths(NeuralNetwork *nn, const TrainingSet *data, const TrainOptions *options, double *predict_seconds, double *train_seconds) {
+    SparseInput rows[PREDICT_TILE];
+    float outputs[PREDICT_TILE * 16];
+    if (nn->output_nodes > 16) return 0;
+
+    *predict_seconds = *train_seconds = 0.0;
+    for (int run = 0; run < 3; run++) {
+        double start = wallSeconds();
+        for (int first = 0; first < data->num_samples; first += PREDICT_TILE) {
+            int count = data->num_samples - first < PREDICT_TILE ? data->num_samples - first : PREDICT_TILE;
+            for (int b = 0; b < count; b++) {
+                rows[b] = trainingSetRow(data, first + b);
+            }
+            if (!predictBatchSparse(nn, rows, count, outputs)) return 0;
+        }
+        double elapsed = wallSeconds() - start;
+        if (run == 0 || elapsed < *predict_seconds) *predict_seconds = elapsed;
+
+        NeuralNetwork *scratch = copyNetwork(nn);
+        TrainWorker *workers = scratch ? createTrainWorkers(scratch, data, options, 1) : NULL;
+        if (!workers) {
+            freeNetwork(scratch);
+            return 0;
+        }
+        start = wallSeconds();
+        runTrainEpoch(workers, 1);
+        elapsed = wallSeconds() - start;
+        if (run == 0 || elapsed < *train_seconds) *train_seconds = elapsed;
+        freeTrainWorkers(workers, 1);
+        freeNetwork(scratch);
+    }
+    return 1;
+}
+
+// Measure what the column order of weights_ih is worth on the sparse paths
+// The training set's own ids (most frequent word first when built by ingestTrainingData) are compared
+// with a fixed random permutation of them: the hot-column cache footprint, predictBatchSparse
+// throughput and single-threaded training throughput. nn is left untouched.
+void reportIndexOrderGain(NeuralNetwork *nn, const TrainingSet *data, const TrainOptions *options) {
+    int N = nn->input_nodes;
+    uint32_t *identity = (uint32_t*)malloc(N * sizeof(uint32_t));
+    uint32_t *shuffle = (uint32_t*)malloc(N * sizeof(uint32_t));
+    uint32_t *hot = (uint32_t*)malloc(N * sizeof(uint32_t));
+    double *occurrences = (double*)calloc(N, sizeof(double));
+    ColumnUse *use = (ColumnUse*)malloc(N * sizeof(ColumnUse));
+    TrainingSet *shuffled = createTrainingSet(data->num_samples, data->nnz);
+    int ok = identity && shuffle && hot && occurrences && use && shuffled;
+
+    if (ok) {
+        // Fisher-Yates with its own generator, so rand() and the weights are not disturbed
+        uint64_t state = 0x9E3779B97F4A7C15ULL;
+        for (int c = 0; c < N; c++) {
+            identity[c] = shuffle[c] = (uint32_t)c;
+        }
+        for (int c = N - 1; c > 0; c--) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            int j = (int)(state % (uint64_t)(c + 1));
+            uint32_t tmp = shuffle[c];
+            shuffle[c] = shuffle[j];
+            shuffle[j] = tmp;
+        }
+
+        double total = 0.0;
+        for (size_t k = 0; k < data->nnz; k++) {
+            occurrences[data->indices[k]] += data->counts[k];
+            total += data->counts[k];
+            shuffled->indices[k] = shuffle[data->indices[k]];
+        }
+        memcpy(shuffled->counts, data->counts, data->nnz * sizeof(float));
+        memcpy(shuffled->labels, data->labels, data->num_samples * sizeof(uint8_t));
+        memcpy(shuffled->row_offsets, data->row_offsets, (data->num_samples + 1) * sizeof(size_t));
+        shuffled->num_samples = data->num_samples;
+        shuffled->nnz = data->nnz;
+
+        for (int c = 0; c < N; c++) {
+            use[c] = (ColumnUse){ .occurrences = occurrences[c], .column = (uint32_t)c };
+        }
+        qsort(use, N, sizeof(ColumnUse), compareColumnUse);
+        for (int c = 0; c < N; c++) {
+            hot[c] = use[c].column;
+        }
+
+        double predict_seconds[2], train_seconds[2];
+        ok = timeSparsePaths(nn, data, options, &predict_seconds[0], &train_seconds[0]) &&
+             timeSparsePaths(nn, shuffled, options, &predict_seconds[1], &train_seconds[1]);
+        if (ok) {
+            printf("Column order  Hot lines (90%% of tokens)  Predict samples/s  Train samples/s\n");
+            const char *names[2] = { "as built", "shuffled" };
+            const uint32_t *positions[2] = { identity, shuffle };
+            for (int o = 0; o < 2; o++) {
+                printf("%-12s  %24zu  %17.0f  %15.0f\n", names[o], hotLines(nn, hot, occurrences, total, positions[o]),
+                       data->num_samples / predict_seconds[o], data->num_samples / train_seconds[o]);
+            }
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "Index order report aborted.\n");
+    }
+
+    free(identity);
+    free(shuffle);
+    free(hot);
+    free(occurrences);
+    free(use);
+    freeTrainingSet(shuffled);
+}
+
+// Create an empty training set with room for the expected number of samples and (index, count) pairs
+TrainingSet* createTrainingSet(int expected_samples, size_t expected_nnz) {
+    TrainingSet *set = (TrainingSet*)calloc(1, sizeof(TrainingSet));
+    if (!set) {
+        perror("Memory allocation failed for TrainingSet");
+        return NULL;
+    }
+
+    set->samples_capacity = expected_samples > 16 ? expected_samples : 16;
+    set->nnz_capacity = expected_nnz > 64 ? expected_nnz : 64;
+    set->row_offsets = (size_t*)malloc((set->samples_capacity + 1) * sizeof(size_t));
+    set->labels = (uint8_t*)malloc(set->samples_capacity * sizeof(uint8_t));
+    set->indices = (uint32_t*)malloc(set->nnz_capacity * sizeof(uint32_t));
+    set->counts = (float*)malloc(set->nnz_capacity * sizeof(float));
+    if (!set->row_offsets || !set->labels || !set->indices || !set->counts) {
+        perror("Memory allocation failed for TrainingSet");
+        freeTrainingSet(set);
+        return NULL;
+    }
+    set->row_offsets[0] = 0;
+    return set;
+}
+
+// Add one occurrence of a token to the sample being built; repeated tokens increase its count
+int trainingSetAddToken(TrainingSet *set, uint32_t index) {
+    size_t start = set->row_offsets[set->num_samples];
+    size_t length = set->nnz - start;
+    if (!set->row_index.stamps || (length + 1) * 2 > (size_t)set->row_index.mask + 1) {
+        // Keep the table at most half full, re-indexing the tokens the open row already has
+        RowIndex grown;
+        if (!rowIndexInit(&grown, (length + 1) * 2)) return 0;
+        for (size_t k = 0; k < length; k++) {
+            rowIndexFind(&grown, set->indices + start, set->indices[start + k], (uint32_t)k);
+        }
+        freeRowIndex(&set->row_index);
+        set->row_index = grown;
+    }
+
+    // Make room before looking the token up, so a failed reallocation leaves the index consistent
+    if (set->nnz == set->nnz_capacity) {
+        size_t capacity = set->nnz_capacity * 2;
+        uint32_t *indices = (uint32_t*)realloc(set->indices, capacity * sizeof(uint32_t));
+        if (!indices) {
+            perror("Reallocation failed for training set indices");
+            return 0;
+        }
+        set->indices = indices;
+        float *counts = (float*)realloc(set->counts, capacity * sizeof(float));
+        if (!counts) {
+            perror("Reallocation failed for training set counts");
+            return 0;
+        }
+        set->counts = counts;
+        set->nnz_capacity = capacity;
+    }
+
+    int k = rowIndexFind(&set->row_index, set->indices + start, index, (uint32_t)length);
+    if (k >= 0) {
+        set->counts[start + k] += 1.0f;
+        return 1;
+    }
+    set->indices[set->nnz] = index;
+    set->counts[set->nnz] = 1.0f;
+    set->nnz++;
+    return 1;
+}
+
+// Close the sample being built, labelling it
+int trainingSetEndRow(TrainingSet *set, uint8_t label) {
+    if (set->num_samples == set->samples_capacity) {
+        int capacity = set->samples_capacity * 2;
+        size_t *row_offsets = (size_t*)realloc(set->row_offsets, (capacity + 1) * sizeof(size_t));
+        if (!row_offsets) {
+            perror("Reallocation failed for training set rows");
+            return 0;
+        }
+        set->row_offsets = row_offsets;
+        uint8_t *labels = (uint8_t*)realloc(set->labels, capacity * sizeof(uint8_t));
+        if (!labels) {
+            perror("Reallocation failed for training set labels");
+            return 0;
+        }
+        set->labels = labels;
+        set->samples_capacity = capacity;
+    }
+
+    set->labels[set->num_samples] = label;
+    set->num_samples++;
+    set->row_offsets[set->num_samples] = set->nnz;
+    if (set->row_index.stamps) rowIndexNext(&set->row_index);
+    return 1;
+}
+
+void freeTrainingSet(TrainingSet *set) {
+    if (!set) return;
+    if (set->mapping) {
+        munmap(set->mapping, set->mapping_size);
+        free(set);
+        return;
+    }
+    free(set->row_offsets);
+    free(set->indices);
+    free(set->counts);
+    free(set->labels);
+    freeRowIndex(&set->row_index);
+    free(set);
+}
+
+// Allocate a table for samples of up to max_tokens distinct tokens, kept at most half full
+int rowIndexInit(RowIndex *ri, size_t max_tokens) {
+    size_t slots = 16;
+    while (slots < max_tokens * 2) slots *= 2;
+    ri->stamps = (uint32_t*)calloc(slots, sizeof(uint32_t));
+    ri->positions = (uint32_t*)malloc(slots * sizeof(uint32_t));
+    if (!ri->stamps || !ri->positions) {
+        perror("Memory allocation failed for RowIndex");
+        freeRowIndex(ri);
+        return 0;
+    }
+    ri->mask = (uint32_t)(slots - 1);
+    ri->stamp = 1;
+    return 1;
+}
+
+int rowIndexFind(RowIndex *ri, const uint32_t *row, uint32_t index, uint32_t position) {
+    uint32_t slot = (uint32_t)(((uint64_t)index * 0x9E3779B97F4A7C15ull) >> 32) & ri->mask;
+    while (ri->stamps[slot] == ri->stamp) {
+        if (row[ri->positions[slot]] == index) return (int)ri->positions[slot];
+        slot = (slot + 1) & ri->mask;
+    }
+    ri->stamps[slot] = ri->stamp;
+    ri->positions[slot] = position;
+    return -1;
+}
+
+void rowIndexNext(RowIndex *ri) {
+    if (++ri->stamp == 0) {
+        // The stamp wrapped around: clear the slots once so no stale one looks current
+        memset(ri->stamps, 0, ((size_t)ri->mask + 1) * sizeof(uint32_t));
+        ri->stamp = 1;
+    }
+}
+
+void freeRowIndex(RowIndex *ri) {
+    free(ri->stamps);
+    free(ri->positions);
+    ri->stamps = NULL;
+    ri->positions = NULL;
+}
+
 // Predict output (Feedforward)
 float* predict(NeuralNetwork *nn, float *inputs) {
     float *hidden_outputs = (float*)malloc(nn->hidden_nodes * sizeof(float));
@@ -229,11 +1252,9 @@ float* predict(NeuralNetwork *nn, float *inputs) {
         return NULL;
     }
 
-    matrixVectorMultiply(hidden_outputs, nn->weights_ih, inputs, nn->hidden_nodes, nn->input_nodes);
-    for (int i = 0; i < nn->hidden_nodes; i++) {
-        hidden_outputs[i] += nn->hidden_bias[i];
-        hidden_outputs[i] = sigmoid(hidden_outputs[i]);
-    }
+    matrixVectorMultiply(hidden_outputs, nn->weights_ih, nn->ih_stride, inputs, nn->hidden_nodes, nn->input_nodes);
+    kernels->add(hidden_outputs, nn->hidden_bias, nn->hidden_nodes);
+    activate(nn->hidden_activation, hidden_outputs, nn->hidden_nodes);
 
     float *outputs = (float*)malloc(nn->output_nodes * sizeof(float));
     if (!outputs) {
@@ -242,122 +1263,402 @@ float* predict(NeuralNetwork *nn, float *inputs) {
         return NULL;
     }
 
-    matrixVectorMultiply(outputs, nn->weights_ho, hidden_outputs, nn->output_nodes, nn->hidden_nodes);
-    for (int i = 0; i < nn->output_nodes; i++) {
-        outputs[i] += nn->output_bias[i];
-        outputs[i] = sigmoid(outputs[i]);
+    matrixVectorMultiply(outputs, nn->weights_ho, nn->ho_stride, hidden_outputs, nn->output_nodes, nn->hidden_nodes);
+    kernels->add(outputs, nn->output_bias, nn->output_nodes);
+    activate(nn->output_activation, outputs, nn->output_nodes);
+
+    free(hidden_outputs);
+    return outputs; // Caller must free this memory!
+}
+
+// Forward pass of one sparse sample into caller-provided hidden and output buffers
+static void forwardSparse(NeuralNetwork *nn, const SparseInput *input, float *hidden, float *output) {
+    sparseMatrixVectorMultiply(hidden, nn->weights_ih, nn->ih_stride, input, nn->hidden_nodes);
+    kernels->add(hidden, nn->hidden_bias, nn->hidden_nodes);
+    activate(nn->hidden_activation, hidden, nn->hidden_nodes);
+
+    matrixVectorMultiply(output, nn->weights_ho, nn->ho_stride, hidden, nn->output_nodes, nn->hidden_nodes);
+    kernels->add(output, nn->output_bias, nn->output_nodes);
+    activate(nn->output_activation, output, nn->output_nodes);
+}
+
+// Predict output (Feedforward) from a sparse bag-of-words sample
+float* predictSparse(NeuralNetwork *nn, const SparseInput *input) {
+    float *hidden_outputs = (float*)malloc(nn->hidden_nodes * sizeof(float));
+    if (!hidden_outputs) {
+        perror("Memory allocation failed for hidden_outputs in predictSparse");
+        return NULL;
+    }
+
+    float *outputs = (float*)malloc(nn->output_nodes * sizeof(float));
+    if (!outputs) {
+        perror("Memory allocation failed for outputs in predictSparse");
+        free(hidden_outputs);
+        return NULL;
     }
 
+    forwardSparse(nn, input, hidden_outputs, outputs);
+
     free(hidden_outputs);
     return outputs; // Caller must free this memory!
 }
 
+// Predict outputs for n dense inputs, writing row b of out (n x output_nodes, row-major) for batch[b]
+// Samples are processed in tiles of PREDICT_TILE so the hidden activations of a tile stay in cache
+int predictBatch(NeuralNetwork *nn, float **batch, int n, float *out) {
+    float *hidden = (float*)malloc((size_t)PREDICT_TILE * nn->hidden_nodes * sizeof(float));
+    if (!hidden) {
+        perror("Memory allocation failed for hidden activations in predictBatch");
+        return 0;
+    }
+
+    for (int first = 0; first < n; first += PREDICT_TILE) {
+        int count = n - first < PREDICT_TILE ? n - first : PREDICT_TILE;
+        denseHiddenTile(nn, batch + first, count, hidden);
+        outputTile(nn, hidden, count, out + (size_t)first * nn->output_nodes);
+    }
+
+    free(hidden);
+    return 1;
+}
+
+// Predict outputs for n sparse bag-of-words inputs; same layout and tiling as predictBatch()
+int predictBatchSparse(NeuralNetwork *nn, const SparseInput *batch, int n, float *out) {
+    float *hidden = (float*)malloc((size_t)PREDICT_TILE * nn->hidden_nodes * sizeof(float));
+    if (!hidden) {
+        perror("Memory allocation failed for hidden activations in predictBatchSparse");
+        return 0;
+    }
+
+    for (int first = 0; first < n; first += PREDICT_TILE) {
+        int count = n - first < PREDICT_TILE ? n - first : PREDICT_TILE;
+        sparseHiddenTile(nn, batch + first, count, hidden);
+        outputTile(nn, hidden, count, out + (size_t)first * nn->output_nodes);
+    }
+
+    free(hidden);
+    return 1;
+}
+
+// Create the scratch buffers for classifying texts of up to max_text_length bytes with nn
+// All allocation happens here, so inferSparse() and the tokenizer never call malloc
+InferenceContext* createInferenceContext(NeuralNetwork *nn, int max_text_length) {
+    InferenceContext *ctx = (InferenceContext*)calloc(1, sizeof(InferenceContext));
+    if (!ctx) {
+        perror("Memory allocation failed for InferenceContext");
+        return NULL;
+    }
+
+    // Tokens are separated by at least one delimiter, so a text holds at most (length + 1) / 2 of them
+    ctx->nn = nn;
+    ctx->max_text_length = max_text_length;
+    ctx->input_capacity = max_text_length / 2 + 1;
+    ctx->input.indices = (uint32_t*)malloc(ctx->input_capacity * sizeof(uint32_t));
+    ctx->input.counts = (float*)malloc(ctx->input_capacity * sizeof(float));
+    ctx->hidden = (float*)malloc(nn->hidden_nodes * sizeof(float));
+    ctx->output = (float*)malloc(nn->output_nodes * sizeof(float));
+    if (!ctx->input.indices || !ctx->input.counts || !ctx->hidden || !ctx->output ||
+        !rowIndexInit(&ctx->row_index, ctx->input_capacity)) {
+        perror("Memory allocation failed for InferenceContext buffers");
+        freeInferenceContext(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+// Run the forward pass for input using the context's buffers
+// Returns ctx->output, which is overwritten by the next call on the same context
+const float* inferSparse(InferenceContext *ctx, const SparseInput *input) {
+    forwardSparse(ctx->nn, input, ctx->hidden, ctx->output);
+    return ctx->output;
+}
+
+void freeInferenceContext(InferenceContext *ctx) {
+    if (!ctx) return;
+    free(ctx->input.indices);
+    free(ctx->input.counts);
+    free(ctx->hidden);
+    free(ctx->output);
+    freeRowIndex(&ctx->row_index);
+    free(ctx);
+}
+
 // Free the neural network memory
 void freeNetwork(NeuralNetwork* nn) {
     if (!nn) return;
 
-    for (int i = 0; i < nn->hidden_nodes; i++) {
-        free(nn->weights_ih[i]);
-    }
-    free(nn->weights_ih);
+    freePerfectHash(&nn->vocab_index);
 
-    for (int i = 0; i < nn->output_nodes; i++) {
-        free(nn->weights_ho[i]);
+    // All weights and biases share the single parameter block
+    if (nn->model_mapping) {
+        munmap(nn->model_mapping, nn->model_mapping_size);
+    }
+    else if (nn->params_mapped) {
+        munmap(nn->params, nn->params_size);
+    }
+    else {
+        free(nn->params);
     }
-    free(nn->weights_ho);
-
-    free(nn->hidden_bias);
-    free(nn->output_bias);
     free(nn);
 }
 
-// Save the neural network and vocabulary to a proprietary binary file
+// Write count zero bytes of padding
+static int writePadding(FILE *fp, size_t count) {
+    static const char zeros[PARAM_ALIGNMENT] = { 0 };
+    while (count > 0) {
+        size_t chunk = count < sizeof(zeros) ? count : sizeof(zeros);
+        if (fwrite(zeros, 1, chunk, fp) != chunk) return 0;
+        count -= chunk;
+    }
+    return 1;
+}
+
+// Save the neural network and vocabulary to a proprietary binary file (MODEL_FILE_VERSION)
 int saveNetworkBinary(NeuralNetwork *nn, char **vocab, int vocab_size, const char* filename) {
-    FILE *fp = fopen(filename, "wb");
-    if (!fp) {
-        perror("Failed to open file for saving network in binary format");
+    // Lay out the file: header, word offsets, strings, vocabulary index, then the aligned parameter block
+    ModelFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "EMOTIONN", 8);
+    header.version = MODEL_FILE_VERSION;
+    header.input_nodes = nn->input_nodes;
+    header.hidden_nodes = nn->hidden_nodes;
+    header.output_nodes = nn->output_nodes;
+    header.hidden_activation = nn->hidden_activation;
+    header.output_activation = nn->output_activation;
+    header.ih_stride = nn->ih_stride;
+    header.ho_stride = nn->ho_stride;
+    header.hash_bits = nn->hash_bits;
+    if (nn->hash_bits > 0) vocab_size = 0; // Feature-hashed inputs need no vocabulary
+    header.vocab_size = vocab_size;
+
+    header.word_offsets_offset = sizeof(ModelFileHeader);
+    header.strings_offset = header.word_offsets_offset + (uint64_t)vocab_size * sizeof(uint32_t);
+    for (int i = 0; i < vocab_size; i++) {
+        header.strings_size += strlen(vocab[i]) + 1;
+    }
+    if (header.strings_size > UINT32_MAX) {
+        fprintf(stderr, "Vocabulary too large to save.\n");
         return 0;
     }
+    uint64_t strings_end = header.strings_offset + header.strings_size;
 
-    // Define a magic number and version for file validation
-    const char magic_number[8] = "EMOTIONN"; // 8 bytes
-    uint32_t version = 1;
-
-    // Write magic number
-    if (fwrite(magic_number, sizeof(char), 8, fp) != 8) {
-        fprintf(stderr, "Failed to write magic number.\n");
-        fclose(fp);
+    // Build the vocabulary index stored after the strings
+    PerfectHash index;
+    memset(&index, 0, sizeof(index));
+    if (vocab_size > 0 && !buildPerfectHash(&index, vocab, vocab_size)) {
+        fprintf(stderr, "Failed to build the vocabulary index.\n");
         return 0;
     }
+    header.index_buckets = index.num_buckets;
+    header.index_offset = (strings_end + sizeof(uint32_t) - 1) / sizeof(uint32_t) * sizeof(uint32_t);
+    uint64_t index_end = header.index_offset + ((uint64_t)index.num_buckets + vocab_size) * sizeof(uint32_t);
 
-    // Write version number
-    if (fwrite(&version, sizeof(uint32_t), 1, fp) != 1) {
-        fprintf(stderr, "Failed to write version number.\n");
-        fclose(fp);
+    header.params_offset = (index_end + PARAM_ALIGNMENT - 1) / PARAM_ALIGNMENT * PARAM_ALIGNMENT;
+    header.params_size = paramsBytes(nn->input_nodes, nn->hidden_nodes, nn->output_nodes);
+
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        perror("Failed to open file for saving network in binary format");
+        freePerfectHash(&index);
         return 0;
     }
 
-    // Write network architecture
-    if (fwrite(&(nn->input_nodes), sizeof(int), 1, fp) != 1 ||
-        fwrite(&(nn->hidden_nodes), sizeof(int), 1, fp) != 1 ||
-        fwrite(&(nn->output_nodes), sizeof(int), 1, fp) != 1 ||
-        fwrite(&vocab_size, sizeof(int), 1, fp) != 1) {
-        fprintf(stderr, "Failed to write network architecture.\n");
+    // Write header
+    if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+        fprintf(stderr, "Failed to write model header.\n");
+        freePerfectHash(&index);
         fclose(fp);
         return 0;
     }
 
-    // Write vocabulary
+    // Write word offsets
+    uint32_t offset = 0;
     for (int i = 0; i < vocab_size; i++) {
-        uint32_t word_length = strlen(vocab[i]);
-        // Write the length of the word
-        if (fwrite(&word_length, sizeof(uint32_t), 1, fp) != 1) {
-            fprintf(stderr, "Failed to write word length for vocab index %d.\n", i);
+        if (fwrite(&offset, sizeof(uint32_t), 1, fp) != 1) {
+            fprintf(stderr, "Failed to write word offset for vocab index %d.\n", i);
+            freePerfectHash(&index);
             fclose(fp);
             return 0;
         }
-        // Write the word characters
+        offset += strlen(vocab[i]) + 1;
+    }
+
+    // Write vocabulary strings, including their terminators
+    for (int i = 0; i < vocab_size; i++) {
+        size_t word_length = strlen(vocab[i]) + 1;
         if (fwrite(vocab[i], sizeof(char), word_length, fp) != word_length) {
             fprintf(stderr, "Failed to write word for vocab index %d.\n", i);
+            freePerfectHash(&index);
             fclose(fp);
             return 0;
         }
     }
 
-    // Write weights_ih
-    for (int i = 0; i < nn->hidden_nodes; i++) {
-        if (fwrite(nn->weights_ih[i], sizeof(float), nn->input_nodes, fp) != (size_t)nn->input_nodes) {
-            fprintf(stderr, "Failed to write weights_ih for hidden node %d.\n", i);
-            fclose(fp);
-            return 0;
+    // Write the vocabulary index (seeds, then slots)
+    if (!writePadding(fp, header.index_offset - strings_end) ||
+        fwrite(index.seeds, sizeof(uint32_t), index.num_buckets, fp) != index.num_buckets ||
+        fwrite(index.slots, sizeof(uint32_t), vocab_size, fp) != (size_t)vocab_size) {
+        fprintf(stderr, "Failed to write the vocabulary index.\n");
+        freePerfectHash(&index);
+        fclose(fp);
+        return 0;
+    }
+    freePerfectHash(&index);
+
+    // Write the parameter block as it is laid out in memory (row padding included)
+    if (!writePadding(fp, header.params_offset - index_end) ||
+        fwrite(nn->params, 1, header.params_size, fp) != header.params_size) {
+        fprintf(stderr, "Failed to write network parameters.\n");
+        fclose(fp);
+        return 0;
+    }
+
+    if (fclose(fp) != 0) {
+        perror("Failed to finish writing model file");
+        return 0;
+    }
+    return 1;
+}
+
+// Release a vocabulary returned by loadNetworkBinary() (call before freeNetwork())
+// Words of a mapped model live inside the mapping, so only the pointer array is freed
+void freeVocabulary(NeuralNetwork *nn, char **vocab, int vocab_size) {
+    if (!vocab) return;
+    if (!nn || !nn->model_mapping) {
+        for (int i = 0; i < vocab_size; i++) {
+            free(vocab[i]);
         }
     }
+    free(vocab);
+}
 
-    // Write weights_ho
-    for (int i = 0; i < nn->output_nodes; i++) {
-        if (fwrite(nn->weights_ho[i], sizeof(float), nn->hidden_nodes, fp) != (size_t)nn->hidden_nodes) {
-            fprintf(stderr, "Failed to write weights_ho for output node %d.\n", i);
-            fclose(fp);
-            return 0;
+// Map a version 3 to 5 model file read-only and use its vocabulary, index and parameters in place
+// Processes that load the same file share its physical pages
+static NeuralNetwork* mapNetworkBinary(int fd, uint32_t version, char ***vocab, int *vocab_size) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("Failed to stat model file");
+        return NULL;
+    }
+    size_t file_size = (size_t)st.st_size;
+    size_t header_size = version >= 5 ? sizeof(ModelFileHeader) : version == 4 ? MODEL_HEADER_V4_SIZE : MODEL_HEADER_V3_SIZE;
+    if (file_size < header_size) {
+        fprintf(stderr, "Model file is truncated.\n");
+        return NULL;
+    }
+
+    void *mapping = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        perror("Failed to map model file");
+        return NULL;
+    }
+    const char *base = (const char*)mapping;
+    const ModelFileHeader *header = (const ModelFileHeader*)mapping;
+
+    // Version 3 files have no index; the field would overlap the word offsets
+    uint32_t index_buckets = version >= 4 ? header->index_buckets : 0;
+    uint64_t index_offset = version >= 4 ? header->index_offset : 0;
+    int hash_bits = version >= 5 ? (int)header->hash_bits : 0;
+
+    // Validate the header against the file before trusting any offset
+    if (header->input_nodes <= 0 || header->hidden_nodes <= 0 || header->output_nodes <= 0 ||
+        header->vocab_size < 0 || header->vocab_size > header->input_nodes) {
+        fprintf(stderr, "Invalid network architecture in model file.\n");
+        munmap(mapping, file_size);
+        return NULL;
+    }
+    if (version >= 5 && header->hash_bits != 0 &&
+        (header->hash_bits > MAX_FEATURE_HASH_BITS || header->input_nodes != 1 << header->hash_bits || header->vocab_size != 0)) {
+        fprintf(stderr, "Invalid feature hashing setup in model file.\n");
+        munmap(mapping, file_size);
+        return NULL;
+    }
+    if (header->hidden_activation >= ACT_COUNT || header->output_activation >= ACT_COUNT) {
+        fprintf(stderr, "Unknown activation function in model file.\n");
+        munmap(mapping, file_size);
+        return NULL;
+    }
+    if (header->ih_stride != (uint32_t)paddedStride(header->input_nodes) ||
+        header->ho_stride != (uint32_t)paddedStride(header->hidden_nodes) ||
+        header->params_size != paramsBytes(header->input_nodes, header->hidden_nodes, header->output_nodes) ||
+        header->params_offset % PARAM_ALIGNMENT != 0 ||
+        header->params_offset > file_size || header->params_size > file_size - header->params_offset ||
+        header->word_offsets_offset % sizeof(uint32_t) != 0 ||
+        header->word_offsets_offset > file_size ||
+        (uint64_t)header->vocab_size * sizeof(uint32_t) > file_size - header->word_offsets_offset ||
+        header->strings_offset > file_size || header->strings_size > file_size - header->strings_offset ||
+        (header->vocab_size > 0 && (header->strings_size == 0 || base[header->strings_offset + header->strings_size - 1] != '\0')) ||
+        (version >= 4 && ((index_buckets == 0 && !hash_bits) || index_offset % sizeof(uint32_t) != 0 || index_offset > file_size ||
+                          ((uint64_t)index_buckets + header->vocab_size) * sizeof(uint32_t) > file_size - index_offset))) {
+        fprintf(stderr, "Corrupt model file: section table does not match the file.\n");
+        munmap(mapping, file_size);
+        return NULL;
+    }
+
+    // The words are used in place; only the pointer array is allocated
+    const uint32_t *word_offsets = (const uint32_t*)(base + header->word_offsets_offset);
+    const char *strings = base + header->strings_offset;
+    *vocab_size = header->vocab_size;
+    *vocab = (char**)malloc((header->vocab_size > 0 ? header->vocab_size : 1) * sizeof(char*));
+    if (!(*vocab)) {
+        perror("Memory allocation failed for vocabulary");
+        munmap(mapping, file_size);
+        return NULL;
+    }
+    for (int i = 0; i < header->vocab_size; i++) {
+        if (word_offsets[i] >= header->strings_size) {
+            fprintf(stderr, "Corrupt model file: word offset out of range for vocab index %d.\n", i);
+            free(*vocab);
+            munmap(mapping, file_size);
+            return NULL;
         }
+        (*vocab)[i] = (char*)(strings + word_offsets[i]);
     }
 
-    // Write hidden_bias
-    if (fwrite(nn->hidden_bias, sizeof(float), nn->hidden_nodes, fp) != (size_t)nn->hidden_nodes) {
-        fprintf(stderr, "Failed to write hidden_bias.\n");
-        fclose(fp);
-        return 0;
+    // Check that every slot names a real word, so lookups never index past the vocabulary
+    const uint32_t *seeds = (const uint32_t*)(base + index_offset);
+    const uint32_t *slots = seeds + index_buckets;
+    for (int i = 0; version >= 4 && i < header->vocab_size; i++) {
+        if (slots[i] >= (uint32_t)header->vocab_size) {
+            fprintf(stderr, "Corrupt model file: vocabulary index out of range.\n");
+            free(*vocab);
+            munmap(mapping, file_size);
+            return NULL;
+        }
     }
 
-    // Write output_bias
-    if (fwrite(nn->output_bias, sizeof(float), nn->output_nodes, fp) != (size_t)nn->output_nodes) {
-        fprintf(stderr, "Failed to write output_bias.\n");
-        fclose(fp);
-        return 0;
+    NeuralNetwork *nn = (NeuralNetwork*)malloc(sizeof(NeuralNetwork));
+    if (!nn) {
+        perror("Memory allocation failed for NeuralNetwork");
+        free(*vocab);
+        munmap(mapping, file_size);
+        return NULL;
     }
+    nn->input_nodes = header->input_nodes;
+    nn->hidden_nodes = header->hidden_nodes;
+    nn->output_nodes = header->output_nodes;
+    nn->hidden_activation = (Activation)header->hidden_activation;
+    nn->output_activation = (Activation)header->output_activation;
+    nn->params = (float*)(base + header->params_offset);
+    nn->params_size = header->params_size;
+    nn->params_mapped = 0;
+    nn->model_mapping = mapping;
+    nn->model_mapping_size = file_size;
+    nn->hash_bits = hash_bits;
+    memset(&nn->vocab_index, 0, sizeof(nn->vocab_index));
+    layoutParams(nn);
 
-    fclose(fp);
-    return 1;
+    // Feature-hashed models need no index: words map to buckets directly
+    if (version >= 4 && !hash_bits) {
+        attachPerfectHash(&nn->vocab_index, *vocab, header->vocab_size, index_buckets, seeds, slots);
+    }
+    else if (!hash_bits && !buildPerfectHash(&nn->vocab_index, *vocab, header->vocab_size)) {
+        free(*vocab);
+        freeNetwork(nn);
+        return NULL;
+    }
+    return nn;
 }
 
 // Load the neural network and vocabulary from a proprietary binary file
@@ -390,7 +1691,14 @@ NeuralNetwork* loadNetworkBinary(const char* filename, char ***vocab, int *vocab
         return NULL;
     }
 
-    if (version != 1) {
+    if (version >= 3 && version <= 5) {
+        NeuralNetwork *nn = mapNetworkBinary(fileno(fp), version, vocab, vocab_size);
+        fclose(fp); // The mapping stays valid after the descriptor is closed
+        return nn;
+    }
+
+    // Versions 1 and 2 are read field by field into a freshly allocated network
+    if (version != 1 && version != 2) {
         fprintf(stderr, "Unsupported version number: %u.\n", version);
         fclose(fp);
         return NULL;
@@ -407,6 +1715,21 @@ NeuralNetwork* loadNetworkBinary(const char* filename, char ***vocab, int *vocab
         return NULL;
     }
 
+    // Read activation functions (version 1 models always used the exact sigmoid)
+    uint32_t activations[2] = { ACT_SIGMOID, ACT_SIGMOID };
+    if (version >= 2) {
+        if (fread(activations, sizeof(uint32_t), 2, fp) != 2) {
+            fprintf(stderr, "Failed to read activation functions.\n");
+            fclose(fp);
+            return NULL;
+        }
+        if (activations[0] >= ACT_COUNT || activations[1] >= ACT_COUNT) {
+            fprintf(stderr, "Unknown activation function in model file.\n");
+            fclose(fp);
+            return NULL;
+        }
+    }
+
     // Allocate and read vocabulary
     *vocab = (char**)malloc((*vocab_size) * sizeof(char*));
     if (!(*vocab)) {
@@ -457,8 +1780,8 @@ NeuralNetwork* loadNetworkBinary(const char* filename, char ***vocab, int *vocab
         (*vocab)[i][word_length] = '\0';
     }
 
-    // Create the network
-    NeuralNetwork *nn = createNetwork(input_nodes, hidden_nodes, output_nodes);
+    // Create the network; every parameter is read below, so skip the random initialization
+    NeuralNetwork *nn = allocateNetwork(input_nodes, hidden_nodes, output_nodes, 0);
     if (!nn) {
         // Free vocabulary
         for (int i = 0; i < *vocab_size; i++) {
@@ -468,10 +1791,12 @@ NeuralNetwork* loadNetworkBinary(const char* filename, char ***vocab, int *vocab
         fclose(fp);
         return NULL;
     }
+    nn->hidden_activation = (Activation)activations[0];
+    nn->output_activation = (Activation)activations[1];
 
     // Read weights_ih
     for (int i = 0; i < hidden_nodes; i++) {
-        if (fread(nn->weights_ih[i], sizeof(float), input_nodes, fp) != (size_t)input_nodes) {
+        if (fread(nn->weights_ih + (size_t)i * nn->ih_stride, sizeof(float), input_nodes, fp) != (size_t)input_nodes) {
             fprintf(stderr, "Failed to read weights_ih for hidden node %d.\n", i);
             freeNetwork(nn);
             for (int k = 0; k < *vocab_size; k++) {
@@ -485,7 +1810,7 @@ NeuralNetwork* loadNetworkBinary(const char* filename, char ***vocab, int *vocab
 
     // Read weights_ho
     for (int i = 0; i < output_nodes; i++) {
-        if (fread(nn->weights_ho[i], sizeof(float), hidden_nodes, fp) != (size_t)hidden_nodes) {
+        if (fread(nn->weights_ho + (size_t)i * nn->ho_stride, sizeof(float), hidden_nodes, fp) != (size_t)hidden_nodes) {
             fprintf(stderr, "Failed to read weights_ho for output node %d.\n", i);
             freeNetwork(nn);
             for (int k = 0; k < *vocab_size; k++) {
@@ -522,5 +1847,15 @@ NeuralNetwork* loadNetworkBinary(const char* filename, char ***vocab, int *vocab
     }
 
     fclose(fp);
+
+    // Older files carry no vocabulary index, so build it now
+    if (!buildPerfectHash(&nn->vocab_index, *vocab, *vocab_size)) {
+        freeNetwork(nn);
+        for (int k = 0; k < *vocab_size; k++) {
+            free((*vocab)[k]);
+        }
+        free(*vocab);
+        return NULL;
+    }
     return nn;
 }
\ No newline at end of file
@@ -3,30 +3,162 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include "activation.h"
+#include "perfectHash.h"
+
+// Samples per tile in predictBatch(); a tile's hidden activations are kept in cache
+#define PREDICT_TILE 64
+
+// Alignment of the parameter block and of every weight row, in bytes (one cache line)
+#define PARAM_ALIGNMENT 64
 
 // Structure for a Neural Network
+// All weights and biases live in one PARAM_ALIGNMENT-aligned block; the matrices are
+// row-major with each row padded to a multiple of PARAM_ALIGNMENT bytes
 typedef struct {
     int input_nodes;
     int hidden_nodes;
     int output_nodes;
-    float **weights_ih; // Weights from Input to Hidden layer
-    float **weights_ho; // Weights from Hidden to Output layer
+    int ih_stride;      // Floats between consecutive rows of weights_ih
+    int ho_stride;      // Floats between consecutive rows of weights_ho
+    float *weights_ih;  // Weights from Input to Hidden layer (hidden_nodes x ih_stride)
+    float *weights_ho;  // Weights from Hidden to Output layer (output_nodes x ho_stride)
     float *hidden_bias;
     float *output_bias;
+    float *params;      // Single allocation backing all weights and biases
+    size_t params_size; // Size of params in bytes
+    int params_mapped;  // Non-zero if params came from mmap rather than the heap
+    void *model_mapping;       // Read-only mapping of a version 3 model file that params points into, or NULL
+    size_t model_mapping_size;
+    PerfectHash vocab_index;   // Word -> input index, set up by loadNetworkBinary(); refers to the vocabulary it returned
+    int hash_bits;             // Above 0, inputs are featureHashBucket() buckets (input_nodes == 1 << hash_bits) and there is no vocabulary
+    Activation hidden_activation; // Stored in the model so inference matches training
+    Activation output_activation;
 } NeuralNetwork;
 
+// Largest hash_bits a feature-hashed network may use
+#define MAX_FEATURE_HASH_BITS 28
+
+// Input bucket of a word in a feature-hashed network, from its tokenizer hash (see Token.hash)
+// The murmur finalizer spreads the FNV bits before the top hash_bits are taken
+static inline uint32_t featureHashBucket(uint64_t word_hash, int hash_bits) {
+    word_hash ^= word_hash >> 33;
+    word_hash *= 0xff51afd7ed558ccdULL;
+    word_hash ^= word_hash >> 33;
+    word_hash *= 0xc4ceb9fe1a85ec53ULL;
+    word_hash ^= word_hash >> 33;
+    return (uint32_t)(word_hash >> (64 - hash_bits));
+}
+
+// Sparse bag-of-words sample: only the vocabulary entries present in the text
+typedef struct {
+    int nnz;           // Number of distinct tokens in the sample
+    uint32_t *indices; // Vocabulary index of each token
+    float *counts;     // Number of occurrences of each token
+} SparseInput;
+
+// Open-addressing table from token index to its position in the sample being built, so repeated
+// tokens are merged in constant time instead of by scanning the sample
+typedef struct {
+    uint32_t *stamps;     // Stamp of the sample each slot was filled for; slots with an older stamp are empty
+    uint32_t *positions;  // Position of the slot's token within its sample
+    uint32_t mask;        // Slots - 1 (a power of two)
+    uint32_t stamp;       // Stamp of the current sample; bumping it empties the table
+} RowIndex;
+
+// Labelled training samples in compressed sparse row (CSR) form
+// Sample i has the (index, count) pairs indices[k], counts[k] for row_offsets[i] <= k < row_offsets[i + 1];
+// its target is the one-hot vector of labels[i] over the output nodes
+typedef struct {
+    int num_samples;
+    size_t nnz;            // Total (index, count) pairs
+    size_t *row_offsets;   // num_samples + 1 entries
+    uint32_t *indices;
+    float *counts;
+    uint8_t *labels;
+    int samples_capacity;  // Allocated rows, for building
+    size_t nnz_capacity;   // Allocated pairs, for building
+    void *mapping;         // Read-only file mapping the arrays point into (see datasetCache.h), or NULL
+    size_t mapping_size;
+    RowIndex row_index;    // Tokens of the open row, for building
+} TrainingSet;
+
+// View of sample i as a SparseInput; points into the training set, nothing is copied
+static inline SparseInput trainingSetRow(const TrainingSet *set, int i) {
+    SparseInput row;
+    row.nnz = (int)(set->row_offsets[i + 1] - set->row_offsets[i]);
+    row.indices = set->indices + set->row_offsets[i];
+    row.counts = set->counts + set->row_offsets[i];
+    return row;
+}
+
+// Scratch buffers for classifying one text at a time without touching the heap
+// Create one per thread with createInferenceContext() and reuse it for every query
+typedef struct {
+    NeuralNetwork *nn;
+    int max_text_length;
+    SparseInput input;  // Sparse sample built from the text; room for every token the text can hold
+    int input_capacity;
+    RowIndex row_index; // Tokens already in input, for merging repeats
+    float *hidden;      // Hidden activations
+    float *output;      // Output activations, valid until the next inference on this context
+} InferenceContext;
+
+// How trainSparse() spreads work over threads
+typedef enum {
+    TRAIN_HOGWILD = 0, // Each thread trains its own shard and updates the shared parameters lock-free
+    TRAIN_SYNC = 1     // Threads split every batch; gradients are reduced in a fixed order (reproducible)
+} TrainMode;
+
+// Hyperparameters for trainSparse()
+typedef struct {
+    float learning_rate;
+    int epochs;
+    int batch_size;  // Samples per weight update; 1 gives per-sample SGD
+    int num_threads; // Worker threads; 1 trains sequentially
+    TrainMode mode;
+} TrainOptions;
+
 // Function prototypes
 NeuralNetwork* createNetwork(int input_nodes, int hidden_nodes, int output_nodes);
+NeuralNetwork* createNetworkWithOptions(int input_nodes, int hidden_nodes, int output_nodes, int use_huge_pages);
+NeuralNetwork* copyNetwork(const NeuralNetwork *nn);
 void train(NeuralNetwork* nn, float **inputs, float **targets, int num_samples, float learning_rate, int epochs);
 float* predict(NeuralNetwork *nn, float *inputs);
+void trainSparse(NeuralNetwork* nn, const TrainingSet *data, const TrainOptions *options);
+void reportHogwildScaling(NeuralNetwork *nn, const TrainingSet *data, const TrainOptions *options, int max_threads);
+void reportIndexOrderGain(NeuralNetwork *nn, const TrainingSet *data, const TrainOptions *options);
+float* predictSparse(NeuralNetwork *nn, const SparseInput *input);
+int predictBatch(NeuralNetwork *nn, float **batch, int n, float *out);
+int predictBatchSparse(NeuralNetwork *nn, const SparseInput *batch, int n, float *out);
 void freeNetwork(NeuralNetwork* nn);
 
+// Building a training set: add the tokens of a sample one by one, then close it with its label
+TrainingSet* createTrainingSet(int expected_samples, size_t expected_nnz);
+int trainingSetAddToken(TrainingSet *set, uint32_t index);
+int trainingSetEndRow(TrainingSet *set, uint8_t label);
+void freeTrainingSet(TrainingSet *set);
+
+// Merging repeated tokens of a sample: rowIndexFind() returns the position of index in row (the sample's
+// indices so far), or records it at position and returns -1; rowIndexNext() starts the next sample
+int rowIndexInit(RowIndex *ri, size_t max_tokens);
+int rowIndexFind(RowIndex *ri, const uint32_t *row, uint32_t index, uint32_t position);
+void rowIndexNext(RowIndex *ri);
+void freeRowIndex(RowIndex *ri);
+
+// Allocation-free inference
+InferenceContext* createInferenceContext(NeuralNetwork *nn, int max_text_length);
+const float* inferSparse(InferenceContext *ctx, const SparseInput *input);
+void freeInferenceContext(InferenceContext *ctx);
+
 // Activation functions
 float sigmoid(float x);
 float sigmoid_derivative(float x);
 
 // Model serialization functions (Binary Format)
 int saveNetworkBinary(NeuralNetwork *nn, char **vocab, int vocab_size, const char* filename);
+void freeVocabulary(NeuralNetwork *nn, char **vocab, int vocab_size);
 NeuralNetwork* loadNetworkBinary(const char* filename, char ***vocab, int *vocab_size);
 
 #endif
\ No newline at end of file
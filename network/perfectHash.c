@@ -0,0 +1,171 @@
+#include "perfectHash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Average words per bucket; larger buckets make the index smaller but the build slower
+#define WORDS_PER_BUCKET 4
+
+// Give up on a bucket after this many seeds (only happens if two words share a 64-bit hash)
+#define MAX_SEED_ATTEMPTS (1u << 24)
+
+uint64_t perfectHashWord(const char *word, size_t length) {
+    uint64_t hash = PERFECT_HASH_BASIS;
+    for (size_t i = 0; i < length; i++) {
+        hash = perfectHashStep(hash, (unsigned char)word[i]);
+    }
+    return hash;
+}
+
+// Finalizer from MurmurHash3, spreads FNV's weak low bits over the whole word
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static inline uint32_t bucketOf(uint64_t hash, uint32_t num_buckets) {
+    return (uint32_t)(mix64(hash) % num_buckets);
+}
+
+static inline uint32_t slotOf(uint64_t hash, uint32_t seed, uint32_t num_words) {
+    return (uint32_t)(mix64(hash ^ ((uint64_t)seed * 0x9e3779b97f4a7c15ULL)) % num_words);
+}
+
+int buildPerfectHash(PerfectHash *ph, char *const *words, uint32_t num_words) {
+    memset(ph, 0, sizeof(*ph));
+    ph->words = words;
+    ph->num_words = num_words;
+    ph->num_buckets = num_words / WORDS_PER_BUCKET + 1;
+    uint32_t nb = ph->num_buckets;
+
+    // Seeds and slots share one allocation so the index can be written or freed as a block
+    ph->storage = (uint32_t*)calloc((size_t)nb + num_words, sizeof(uint32_t));
+    uint64_t *hashes = (uint64_t*)malloc((num_words ? num_words : 1) * sizeof(uint64_t));
+    uint32_t *bucket_start = (uint32_t*)calloc((size_t)nb + 1, sizeof(uint32_t));
+    uint32_t *members = (uint32_t*)malloc((num_words ? num_words : 1) * sizeof(uint32_t));
+    uint32_t *order = (uint32_t*)malloc(nb * sizeof(uint32_t));
+    uint32_t *size_start = NULL;
+    unsigned char *taken = (unsigned char*)calloc(num_words ? num_words : 1, 1);
+    uint32_t attempt[64];
+    int ok = 0;
+    if (!ph->storage || !hashes || !bucket_start || !members || !order || !taken) {
+        perror("Memory allocation failed in buildPerfectHash");
+        goto done;
+    }
+    uint32_t *seeds = ph->storage;
+    uint32_t *slots = ph->storage + nb;
+
+    // Group words by bucket (counting sort)
+    uint32_t max_size = 0;
+    for (uint32_t i = 0; i < num_words; i++) {
+        hashes[i] = perfectHashWord(words[i], strlen(words[i]));
+        bucket_start[bucketOf(hashes[i], nb) + 1]++;
+    }
+    for (uint32_t b = 0; b < nb; b++) {
+        if (bucket_start[b + 1] > max_size) max_size = bucket_start[b + 1];
+        bucket_start[b + 1] += bucket_start[b];
+    }
+    if (max_size > sizeof(attempt) / sizeof(attempt[0])) {
+        fprintf(stderr, "Perfect hash bucket too large (%u words).\n", max_size);
+        goto done;
+    }
+    {
+        uint32_t *fill = order; // Borrowed as the per-bucket write cursor
+        memcpy(fill, bucket_start, nb * sizeof(uint32_t));
+        for (uint32_t i = 0; i < num_words; i++) {
+            members[fill[bucketOf(hashes[i], nb)]++] = i;
+        }
+    }
+
+    // Place the largest buckets first, while the table is still mostly empty (counting sort by size)
+    size_start = (uint32_t*)calloc(max_size + 2, sizeof(uint32_t));
+    if (!size_start) {
+        perror("Memory allocation failed in buildPerfectHash");
+        goto done;
+    }
+    for (uint32_t b = 0; b < nb; b++) {
+        size_start[max_size - (bucket_start[b + 1] - bucket_start[b]) + 1]++;
+    }
+    for (uint32_t s = 0; s <= max_size; s++) {
+        size_start[s + 1] += size_start[s];
+    }
+    for (uint32_t b = 0; b < nb; b++) {
+        order[size_start[max_size - (bucket_start[b + 1] - bucket_start[b])]++] = b;
+    }
+
+    for (uint32_t k = 0; k < nb; k++) {
+        uint32_t b = order[k];
+        uint32_t first = bucket_start[b];
+        uint32_t size = bucket_start[b + 1] - first;
+        if (size == 0) break; // Buckets are sorted by size, so the rest are empty too
+
+        uint32_t seed = 0;
+        for (;; seed++) {
+            if (seed == MAX_SEED_ATTEMPTS) {
+                fprintf(stderr, "Failed to build perfect hash (duplicate words in vocabulary?).\n");
+                goto done;
+            }
+            uint32_t j = 0;
+            for (; j < size; j++) {
+                uint32_t slot = slotOf(hashes[members[first + j]], seed, num_words);
+                if (taken[slot]) break;
+                taken[slot] = 1;
+                attempt[j] = slot;
+            }
+            if (j == size) break;
+            // Undo the slots claimed by this attempt
+            while (j > 0) taken[attempt[--j]] = 0;
+        }
+
+        seeds[b] = seed;
+        for (uint32_t j = 0; j < size; j++) {
+            slots[attempt[j]] = members[first + j];
+        }
+    }
+
+    ph->seeds = seeds;
+    ph->slots = slots;
+    ok = 1;
+
+done:
+    free(hashes);
+    free(bucket_start);
+    free(members);
+    free(order);
+    free(size_start);
+    free(taken);
+    if (!ok) freePerfectHash(ph);
+    return ok;
+}
+
+void attachPerfectHash(PerfectHash *ph, char *const *words, uint32_t num_words, uint32_t num_buckets, const uint32_t *seeds, const uint32_t *slots) {
+    ph->num_words = num_words;
+    ph->num_buckets = num_buckets;
+    ph->seeds = seeds;
+    ph->slots = slots;
+    ph->words = words;
+    ph->storage = NULL;
+}
+
+int perfectHashLookupHashed(const PerfectHash *ph, const char *word, size_t length, uint64_t hash) {
+    if (ph->num_words == 0) return -1;
+    uint32_t seed = ph->seeds[bucketOf(hash, ph->num_buckets)];
+    uint32_t index = ph->slots[slotOf(hash, seed, ph->num_words)];
+    const char *candidate = ph->words[index];
+    // Every slot holds some word, so the compare is what rejects out-of-vocabulary tokens
+    if (strncmp(candidate, word, length) != 0 || candidate[length] != '\0') return -1;
+    return (int)index;
+}
+
+int perfectHashLookup(const PerfectHash *ph, const char *word, size_t length) {
+    return perfectHashLookupHashed(ph, word, length, perfectHashWord(word, length));
+}
+
+void freePerfectHash(PerfectHash *ph) {
+    free(ph->storage);
+    memset(ph, 0, sizeof(*ph));
+}
@@ -0,0 +1,43 @@
+#ifndef PERFECT_HASH_H
+#define PERFECT_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Minimal perfect hash of a frozen vocabulary (hash-and-displace)
+// Every word hashes to a bucket; each bucket stores the seed that sends its words to
+// distinct slots of a table with exactly one slot per word. A lookup is one hash of the
+// word, one probe of the slot table and one string compare against the vocabulary.
+// The seeds and slots are stored in the model file, so the hash function must not change.
+typedef struct {
+    uint32_t num_words;
+    uint32_t num_buckets;
+    const uint32_t *seeds;  // Displacement seed per bucket
+    const uint32_t *slots;  // Vocabulary index stored in each slot
+    char *const *words;     // Vocabulary the index was built for (not owned)
+    uint32_t *storage;      // Owned seeds and slots when built in memory; NULL when they live in a model file
+} PerfectHash;
+
+// Hash of a word as used by the index (FNV-1a over the bytes)
+// Tokenizers can compute it incrementally with PERFECT_HASH_BASIS and perfectHashStep()
+#define PERFECT_HASH_BASIS 14695981039346656037ULL
+static inline uint64_t perfectHashStep(uint64_t hash, unsigned char c) {
+    return (hash ^ c) * 1099511628211ULL;
+}
+uint64_t perfectHashWord(const char *word, size_t length);
+
+// Build the index for words[0..num_words); the words must be distinct
+// Returns 1 on success, 0 on failure
+int buildPerfectHash(PerfectHash *ph, char *const *words, uint32_t num_words);
+
+// Use seeds and slots that were built earlier (e.g. mapped from a model file) without copying them
+void attachPerfectHash(PerfectHash *ph, char *const *words, uint32_t num_words, uint32_t num_buckets, const uint32_t *seeds, const uint32_t *slots);
+
+// Vocabulary index of word[0..length), or -1 if it is not in the vocabulary
+int perfectHashLookup(const PerfectHash *ph, const char *word, size_t length);
+// Same, with hash = perfectHashWord(word, length) already computed
+int perfectHashLookupHashed(const PerfectHash *ph, const char *word, size_t length, uint64_t hash);
+
+void freePerfectHash(PerfectHash *ph);
+
+#endif